@@ -1,4 +1,20 @@
 #include <iostream>
+#include <fstream>
+#include <string>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdint.h>
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define SINE_X86_SIMD
+#endif
+#if defined(__GNUC__) && defined(__unix__)
+#include <pthread.h>
+#include <unistd.h>
+#define SINE_THREADS
+#endif
 using namespace std;
 
 // Project: Sine Approximation
@@ -13,10 +29,147 @@ using namespace std;
 const double PI_VALUE = 3.14159265359;
 const int MIN_NUM_TERM = 1;
 const int MAX_NUM_TERM = 5;
+// Most terms "approximateSineToTolerance" will use. On [-π/2, π/2] the
+// remainder after this many terms is below 1e-20.
+const int MAX_SERIES_NUM_TERM = 12;
 const int MIN_VAL_FCTRL = 0;
 const int MAX_VAL_FCTRL = 12;
 const char TYPE_DEGREE = 'd';
 const char TYPE_RADIAN = 'r';
+// Command line flag that switches main to batch mode
+const string BATCH_MODE_FLAG = "-b";
+// Written in place of a result for a batch record that is out of range
+const string BATCH_INVALID_TEXT = "invalid";
+// Bytes read or written per block in batch mode, and the longest line
+const int BATCH_BUFFER_SIZE = 1 << 16;
+const int BATCH_MAX_LINE_SIZE = 64;
+// π split into pieces for range reduction (Cody-Waite). The first three
+// have 24 significant bits, so k * piece is exact for |k| < 2^29.
+const double PI_PART_1 = 3.141592502593994;
+const double PI_PART_2 = 1.5099578831723193e-07;
+const double PI_PART_3 = 1.078060505991553e-14;
+const double PI_PART_4 = 6.564007085747001e-22;
+const double INV_PI_VALUE = 0.3183098861837907;
+// Doubles at or above 2^52 are whole numbers
+const double ROUND_MAGIC_VAL = 4503599627370496.0;
+// Largest angle size the Cody-Waite split handles (k stays below 2^29);
+// bigger angles are reduced with Payne-Hanek instead
+const double CODY_WAITE_MAX_RAD = 1.6e9;
+// Bits of 1/π after the binary point, 32 per word. The largest double is
+// below 2^1024, so these cover the bits any angle can need.
+const int INV_PI_NUM_WORDS = 38;
+const uint32_t INV_PI_BITS[INV_PI_NUM_WORDS] =
+{
+  0x517CC1B7, 0x27220A94, 0xFE13ABE8, 0xFA9A6EE0,
+  0x6DB14ACC, 0x9E21C820, 0xFF28B1D5, 0xEF5DE2B0,
+  0xDB92371D, 0x2126E970, 0x03249775, 0x04E8C90E,
+  0x7F0EF58E, 0x5894D39F, 0x74411AFA, 0x975DA242,
+  0x74CE3813, 0x5A2FBF20, 0x9CC8EB1C, 0xC1A99CFA,
+  0x4E422FC5, 0xDEFC941D, 0x8FFC4BFF, 0xEF02CC07,
+  0xF79788C5, 0xAD05368F, 0xB69B3F67, 0x93E584DB,
+  0xA7A31FB3, 0x4F2FF516, 0xBA93DD63, 0xF5F2F8BD,
+  0x9E839CFB, 0xC5294975, 0x35FDAFD8, 0x8FC6AE84,
+  0x2B019823, 0x7E3DB5D5
+};
+// Words of 1/π multiplied into the angle per Payne-Hanek reduction, which
+// keeps at least 128 correct bits of angle / π after the binary point
+const int PAYNE_HANEK_NUM_WORDS = 8;
+const double TWO_POW_MINUS_64 = 1.0 / 18446744073709551616.0;
+// Lookup-table mode. Entries are spaced evenly over [0, π/2], so with N
+// entries the spacing is h = (π/2) / (N - 1), and the worst-case error is
+// h^2 / 8 for linear and about 0.064 h^3 for quadratic interpolation:
+//    N     bytes   linear   quadratic
+//    256    2 KiB  4.7e-6   1.5e-8
+//   1024    8 KiB  2.9e-7   2.3e-10
+//   2048   16 KiB  7.4e-8   2.9e-11
+//   4096   32 KiB  1.8e-8   3.6e-12
+// The default fits a 32 KiB L1 data cache with room to spare.
+const int DEFAULT_SINE_TABLE_SIZE = 2048;
+const int MIN_SINE_TABLE_SIZE = 2;
+// Entries past π/2, so the quadratic stencil never runs off the end
+const int SINE_TABLE_GUARD_SIZE = 2;
+const double SINE_TABLE_BUILD_TOLERANCE = 1.0e-17;
+const int INTERP_LINEAR = 1;
+const int INTERP_QUADRATIC = 2;
+const double HALF_PI_VALUE = 1.5707963267948966;
+// Angles per chunk of a sweep (64 KiB of output). Chunk boundaries after
+// the first fall on cache lines, so no two threads write the same line.
+const int SWEEP_CHUNK_SIZE = 8192;
+const int CACHE_LINE_SIZE = 64;
+// Upper limit on sweep threads, whatever the core count says
+const int MAX_SWEEP_THREADS = 256;
+// Fixed-point mode. Angles are in half turns, so Q1.15 angle a (or Q1.31
+// angle a) means a / 2^15 (or a / 2^31) times π, covering -π to π; sine
+// values are Q1.15 / Q1.31 and saturate at the largest positive value.
+const int FIXED_Q15_NUM_TERM = 5;
+const int FIXED_Q31_NUM_TERM = 8;
+const int32_t Q15_ONE = 1 << 15;
+const int32_t Q15_QUARTER_TURN = 1 << 14;
+const int32_t Q15_MIN_VAL = -32768;
+const int32_t Q15_MAX_VAL = 32767;
+const int64_t Q31_ONE = (int64_t)1 << 31;
+const int64_t Q31_QUARTER_TURN = (int64_t)1 << 30;
+const int64_t Q31_MIN_VAL = -((int64_t)1 << 31);
+const int64_t Q31_MAX_VAL = ((int64_t)1 << 31) - 1;
+// Sine series in y = 2 * angle, which is -1 to 1 after folding:
+// sin(π/2 * y) = sum of (-1)^i (π/2)^(2i + 1) / (2i + 1)! * y^(2i + 1),
+// with the coefficients rounded to Q15 and Q31
+const int32_t SINE_COEF_Q15[FIXED_Q15_NUM_TERM] =
+{
+  51472,
+  -21167,
+  2611,
+  -153,
+  5
+};
+const int64_t SINE_COEF_Q31[FIXED_Q31_NUM_TERM] =
+{
+  3373259426LL,
+  -1387197337LL,
+  171138612LL,
+  -10053990LL,
+  344545LL,
+  -7728LL,
+  122LL,
+  -1LL
+};
+// Largest difference between "approximateSineBatch" and "approximateSine"
+// for any angle and any number of terms from MIN_NUM_TERM to MAX_NUM_TERM
+const double BATCH_SINE_TOLERANCE = 1.0e-13;
+// Taylor coefficients (-1)^i / (2i + 1)! of the sine series, so term "i"
+// is SINE_COEF[i] * x^(2i + 1)
+const double SINE_COEF[MAX_SERIES_NUM_TERM] = 
+{
+  1.0,
+  -1.0 / 6.0,
+  1.0 / 120.0,
+  -1.0 / 5040.0,
+  1.0 / 362880.0,
+  -1.0 / 39916800.0,
+  1.0 / 6227020800.0,
+  -1.0 / 1307674368000.0,
+  1.0 / 355687428096000.0,
+  -1.0 / 121645100408832000.0,
+  1.0 / 51090942171709440000.0,
+  -1.0 / 25852016738884976640000.0
+};
+// Taylor coefficients (-1)^i / (2i)! of the cosine series, so term "i" is
+// COSINE_COEF[i] * x^(2i)
+const double COSINE_COEF[MAX_SERIES_NUM_TERM] = 
+{
+  1.0,
+  -1.0 / 2.0,
+  1.0 / 24.0,
+  -1.0 / 720.0,
+  1.0 / 40320.0,
+  -1.0 / 3628800.0,
+  1.0 / 479001600.0,
+  -1.0 / 87178291200.0,
+  1.0 / 20922789888000.0,
+  -1.0 / 6402373705728000.0,
+  1.0 / 2432902008176640000.0,
+  -1.0 / 1124000727777607680000.0
+};
 
 // --- Function ---
 
@@ -38,27 +191,203 @@ bool computeFactorial(const int inVal, int& outFactorial);
 //This function approximates the value of the sine of "angleRad", using the
 //number of terms specified via "numTerms". The result is stored in the 
 //output reference parameter "outSineVal". Support input angles of any
-//value, but will set it in the range -π to +π. Fail when either 
-//"numTerms" is not in the range(1 to 5 inclusive), or functions
-//(toThePower and computeFactorial) fail. Return true on success.
+//value, but will fold it into the range -π/2 to +π/2. The series is evaluated
+//by the "approximateSineTerms" instantiation for "numTerms", so no powers or
+//factorials are computed per call. Fail when "numTerms" is not in the
+//range(1 to 5 inclusive). Return true on success.
 bool approximateSine(const double angleRad, const int numTerms, 
                      double& outSineVal);
 
+//This function template approximates the sine of "angleRad" using
+//"NUM_TERMS" terms and returns the result. The term count is fixed at
+//compile time, so the series is fully unrolled; a count outside the range(1
+//to 5 inclusive) does not compile. Folds the angle like "approximateSine".
+template <int NUM_TERMS>
+double approximateSineTerms(const double angleRad);
+
+//This function approximates the sine of "angleRad" for every number of
+//terms from 1 to "numTerms" in a single pass: the angle is reduced once and
+//each term is added to the running sum, so "outPartialSums[i]" holds the
+//result using i + 1 terms. Fail when "numTerms" is not in the range(1 to 5
+//inclusive). Return true on success.
+bool approximateSinePartialSums(const double angleRad, const int numTerms,
+                                double outPartialSums[]);
+
+//This function approximates the sine of "angleRad", adding terms only until
+//the remainder bound falls to "maxAbsError" or below, so small angles need
+//fewer terms than ones near ±π/2. The result is stored in "outSineVal" and
+//the number of terms used in "outNumTerms"; it may exceed 5, up to
+//MAX_SERIES_NUM_TERM, whose remainder is below any useful tolerance. On the
+//folded angle the series alternates with shrinking terms, so the first
+//term left out bounds the error (plus double rounding, about 1e-16). Fail
+//when "maxAbsError" is not positive. Return true on success.
+bool approximateSineToTolerance(const double angleRad,
+                                const double maxAbsError,
+                                double& outSineVal, int& outNumTerms);
+
+//This function checks that "numTerms" is in the range(1 to 5 inclusive),
+//printing an error message when it is not. Return true if it is valid.
+bool checkNumTerms(const int numTerms);
+
+//This function approximates the sine of each of the "numAngles" values in
+//"anglesRad" using "numTerms" terms, storing the results in the same
+//positions of "outSineVals". The series is evaluated on several angles per
+//instruction (AVX2 or SSE2, picked at runtime, with a scalar fallback).
+//Results match "approximateSine" to within BATCH_SINE_TOLERANCE. Fail when
+//"numTerms" is not in the range(1 to 5 inclusive) or "numAngles" is
+//negative. Return true on success.
+bool approximateSineBatch(const double anglesRad[], const int numAngles,
+                          const int numTerms, double outSineVals[]);
+
+//This function approximates both the sine and the cosine of "angleRad",
+//using "numTerms" terms of each series, and stores them in "outSineVal"
+//and "outCosineVal". The angle is reduced once and the two polynomials are
+//evaluated side by side; the sine is identical to "approximateSine". Fail
+//when "numTerms" is not in the range(1 to 5 inclusive). Return true on
+//success.
+bool approximateSinCos(const double angleRad, const int numTerms,
+                       double& outSineVal, double& outCosineVal);
+
+//This function is the batch form of "approximateSinCos": for each of the
+//"numAngles" values in "anglesRad" it stores the sine and cosine in the
+//same positions of "outSineVals" and "outCosineVals", several angles per
+//instruction like "approximateSineBatch" and within BATCH_SINE_TOLERANCE
+//of "approximateSinCos". Fail when "numTerms" is not in the range(1 to 5
+//inclusive) or "numAngles" is negative. Return true on success.
+bool approximateSinCosBatch(const double anglesRad[], const int numAngles,
+                            const int numTerms, double outSineVals[],
+                            double outCosineVals[]);
+
+//This function builds the table used by "approximateSineTable", holding
+//the sine at "numEntries" evenly spaced angles from 0 to π/2 (see
+//DEFAULT_SINE_TABLE_SIZE for the accuracy of each size). Call it before
+//serving queries to pay the build cost up front; a table that already
+//exists is replaced. Fail when "numEntries" is less than 2. Return true on
+//success.
+bool initSineTable(const int numEntries);
+
+//This function frees the table built by "initSineTable".
+void releaseSineTable();
+
+//This function approximates the sine of "angleRad" from the lookup table,
+//interpolating between entries with "interpMode" (INTERP_LINEAR or
+//INTERP_QUADRATIC) after folding the angle like "approximateSine". A table
+//of DEFAULT_SINE_TABLE_SIZE entries is built on first use if
+//"initSineTable" was never called; that build is not thread-safe, so call
+//"initSineTable" first when several threads share the table. Fail when
+//"interpMode" is not one of the two modes or "angleRad" is NaN or
+//infinite. Return true on success.
+bool approximateSineTable(const double angleRad, const int interpMode,
+                          double& outSineVal);
+
+//This function fills "outSineVals" with the sine of the "numAngles" angles
+//"startRad", "startRad" + "stepRad", ... using "numTerms" terms. The buffer
+//is split into cache-aligned chunks that "numThreads" threads (0 means one
+//per online core) share out, each thread stealing chunks from the others
+//once its own run out. Angle i is always computed directly as "startRad" +
+//i * "stepRad", so the output is bit-identical to calling
+//"approximateSine" on each angle, whatever the number of threads. Fail
+//when "numTerms" is not in the range(1 to 5 inclusive), or "numAngles" or
+//"numThreads" is negative. Return true on success.
+bool approximateSineSweep(const double startRad, const double stepRad,
+                          const long numAngles, const int numTerms,
+                          const int numThreads, double outSineVals[]);
+
+//This function approximates the sine of the Q1.15 angle "angleQ15" (in
+//half turns, see FIXED_Q15_NUM_TERM) using only integer arithmetic, and
+//returns it as a Q1.15 value. The angle is folded like "reduceAngle" and
+//the series is evaluated with Horner's scheme on Q15 coefficients, so the
+//result is the same on every machine. Within 2 units of the last place of
+//the true sine.
+int16_t approximateSineQ15(const int16_t angleQ15);
+
+//This function is the Q1.31 form of "approximateSineQ15", evaluating
+//FIXED_Q31_NUM_TERM terms with 64-bit intermediates. Within 4 units of the
+//last place of the true sine.
+int32_t approximateSineQ31(const int32_t angleQ31);
+
+//This function stores "approximateSineQ15" of each of the "numAngles"
+//values in "anglesQ15" in the same positions of "outSineVals", eight angles
+//per instruction when the CPU has AVX2. Results are bit-identical to the
+//scalar form. Fail when "numAngles" is negative. Return true on success.
+bool approximateSineQ15Batch(const int16_t anglesQ15[], const int numAngles,
+                             int16_t outSineVals[]);
+
+//This function is the batch form of "approximateSineQ31". AVX2 has no
+//64-bit lane multiply, so it runs the scalar form per angle. Fail when
+//"numAngles" is negative. Return true on success.
+bool approximateSineQ31Batch(const int32_t anglesQ31[], const int numAngles,
+                             int32_t outSineVals[]);
+
+//This function reduces "angleRad" to "outReducedRad" in the range -π/2 to
+//+π/2 in constant time, however large the angle is, by removing the
+//nearest whole multiple k of π. The sine (and cosine) of "angleRad" equal
+//those of "outReducedRad" times the returned sign, which is -1 for odd k
+//and +1 otherwise. Angles larger than CODY_WAITE_MAX_RAD are reduced
+//against the stored bits of 1/π (Payne-Hanek), so any finite angle is
+//reduced to full double accuracy. A NaN or infinite angle reduces to NaN,
+//so every sine built on it is NaN, like std::sin.
+int reduceAngle(const double angleRad, double& outReducedRad);
+
+//This function rounds "inVal" to the nearest whole number (ties to even)
+//and returns the result.
+double roundToNearest(const double inVal);
+
+//This function runs the non-interactive batch mode: it reads records of
+//the form "unit angle numTerms" (unit is d or r, separated by any
+//spaces) from "inStream", one per line, until the end of input, and writes
+//one line per record to "outStream" holding the sine computed by
+//"approximateSine", or BATCH_INVALID_TEXT when the unit or number of terms
+//is out of range. Both streams are used in blocks of BATCH_BUFFER_SIZE
+//bytes and nothing is flushed per record. Return false (after writing the
+//results so far) if a record cannot be parsed.
+bool runSineBatch(istream& inStream, ostream& outStream);
+
 #ifdef ANDREW_TEST
 #include "andrewTest.h"
+#elif defined(SINE_BENCH)
+#include "sineBench402.h"
 #else
 
-int main()
+int main(int argc, char* argv[])
 {
   char angleType;
   bool isSuccess; // indicates whether the whole process goes successfully
   double angleInputVal;
   double angleStdVal; // standard angle value for approximation
-  double approxResult;
+  double partialSums[MAX_NUM_TERM]; // result for each number of terms
   int numTerm;
 
   isSuccess = true;
 
+  // "-b [file]" streams records from the file (or stdin) instead of asking
+  if (argc > 1 && argv[1] == BATCH_MODE_FLAG)
+  {
+    ifstream inFile;
+    bool isBatchOk;
+
+    // the prompts are never used in batch mode, so C stdio sync can go
+    ios_base::sync_with_stdio(false);
+    cin.tie(0);
+
+    if (argc > 2)
+    {
+      inFile.open(argv[2]);
+      if (inFile.fail())
+      {
+        cerr << "ERROR: Unable to open " << argv[2] << "!" << endl;
+        return 1;
+      }
+      isBatchOk = runSineBatch(inFile, cout);
+    }
+    else
+    {
+      isBatchOk = runSineBatch(cin, cout);
+    }
+
+    return isBatchOk ? 0 : 1;
+  }
+
   // input angle type
   cout << "Would you like to enter angle in degrees (" << TYPE_DEGREE 
        << ") or radians (" << TYPE_RADIAN << ")? ";
@@ -92,15 +421,17 @@ int main()
       angleStdVal = angleInputVal;
     }
 
-    // check approximation function
-    if (!approximateSine(angleStdVal, numTerm, approxResult))
+    // check approximation function, all numbers of terms come from a
+    // single pass over the series
+    if (!checkNumTerms(numTerm) ||
+        !approximateSinePartialSums(angleStdVal, MAX_NUM_TERM, partialSums))
     {
       isSuccess = false;
     }
     else
     {
       // print result
-      cout << "sin(angle) = " << approxResult << endl;
+      cout << "sin(angle) = " << partialSums[numTerm - MIN_NUM_TERM] << endl;
       cout << endl;
       cout << "Here are results for other numbers of terms:" << endl;
       //print other result
@@ -108,12 +439,9 @@ int main()
       {
         if (i != numTerm)
         {
-          double otherResult;
-          if(approximateSine(angleStdVal, i, otherResult))
-          {
-            cout << "  # terms: " << i << " result: " << otherResult;
-            cout << endl;
-          }
+          cout << "  # terms: " << i << " result: "
+               << partialSums[i - MIN_NUM_TERM];
+          cout << endl;
         }
       }
     }
@@ -195,80 +523,1356 @@ bool computeFactorial(const int inVal, int& outFactorial)
   return doSuccess;
 }
 
+// Compiles only when the condition is true
+template <bool IS_VALID>
+struct CompileTimeCheck;
+
+template <>
+struct CompileTimeCheck<true>
+{
+};
+
+// Horner's scheme over SINE_COEF[TERM_INDEX] .. SINE_COEF[TERM_INDEX +
+// NUM_LEFT - 1], expanded by the compiler into straight-line code with the
+// same operation order as the loop it replaces
+template <int NUM_LEFT, int TERM_INDEX>
+struct SineHorner
+{
+  static double evaluate(const double angleSqrVal)
+  {
+    return SineHorner<NUM_LEFT - 1, TERM_INDEX + 1>::evaluate(angleSqrVal) *
+           angleSqrVal + SINE_COEF[TERM_INDEX];
+  }
+};
+
+template <int TERM_INDEX>
+struct SineHorner<1, TERM_INDEX>
+{
+  static double evaluate(const double)
+  {
+    return SINE_COEF[TERM_INDEX];
+  }
+};
+
+template <int NUM_TERMS>
+double approximateSineTerms(const double angleRad)
+{
+  double angleStdRad;
+  int signVal;
+
+  (void)sizeof(CompileTimeCheck<(NUM_TERMS >= MIN_NUM_TERM &&
+                                 NUM_TERMS <= MAX_NUM_TERM)>);
+
+  // standardize the range of angle, sin(x + kπ) = (-1)^k sin(x), and sine
+  // is odd so the sign can move onto the angle
+  signVal = reduceAngle(angleRad, angleStdRad);
+  angleStdRad *= signVal;
+
+  // x * (c0 + x^2 * (c1 + x^2 * (c2 + ...)))
+  return SineHorner<NUM_TERMS, 0>::evaluate(angleStdRad * angleStdRad) *
+         angleStdRad;
+}
+
+typedef double (*SineTermsFuncType)(const double angleRad);
+
+// "approximateSineTerms" for each number of terms, from MIN_NUM_TERM up
+static const SineTermsFuncType SINE_TERMS_FUNC[MAX_NUM_TERM] =
+{
+  approximateSineTerms<1>,
+  approximateSineTerms<2>,
+  approximateSineTerms<3>,
+  approximateSineTerms<4>,
+  approximateSineTerms<5>
+};
+
 bool approximateSine(const double angleRad, const int numTerms,
                      double& outSineVal)
+{
+  bool doSuccess;
+  
+  doSuccess = true;
+  
+  if (!checkNumTerms(numTerms))
+  {
+    doSuccess = false;
+  }
+  else
+  {
+    outSineVal = SINE_TERMS_FUNC[numTerms - MIN_NUM_TERM](angleRad);
+  }
+  
+  return doSuccess;
+}
+
+bool approximateSinePartialSums(const double angleRad, const int numTerms,
+                                double outPartialSums[])
 {
   double angleStdRad;
-  int coefFctrl;
-  int inValFctrl;
-  double coefNegPow;
-  double negBaseVal;
-  int negExpVal; 
-  double coefAnglePow;
-  int angleExpVal;
+  double angleSqrVal;
+  double anglePowVal;
   double sumTermVal;
   bool doSuccess;
-  bool doNegPow;
-  bool doAnglePow;
-  bool doFctrl;
-  
+  int signVal;
+
   doSuccess = true;
-  // standardize the range of angle
-  if (angleRad >= -PI_VALUE && angleRad <= PI_VALUE)
+  signVal = reduceAngle(angleRad, angleStdRad);
+  angleStdRad *= signVal;
+
+  if (!checkNumTerms(numTerms))
   {
-    angleStdRad = angleRad;
+    doSuccess = false;
   }
   else
   {
-    angleStdRad = angleRad;
-    while (angleStdRad < -PI_VALUE)
+    // x^(2i + 1) is carried from term to term
+    angleSqrVal = angleStdRad * angleStdRad;
+    anglePowVal = angleStdRad;
+    sumTermVal = 0.0;
+    for (int i = 0; i < numTerms; i++)
     {
-      angleStdRad += 2 * PI_VALUE;
+      sumTermVal += SINE_COEF[i] * anglePowVal;
+      outPartialSums[i] = sumTermVal;
+      anglePowVal *= angleSqrVal;
     }
-    while (angleStdRad > PI_VALUE)
+  }
+
+  return doSuccess;
+}
+
+bool approximateSineToTolerance(const double angleRad,
+                                const double maxAbsError,
+                                double& outSineVal, int& outNumTerms)
+{
+  double angleStdRad;
+  double angleSqrVal;
+  double anglePowVal;
+  double termVal;
+  double sumTermVal;
+  bool doSuccess;
+  int signVal;
+  int numTerms;
+
+  doSuccess = true;
+  signVal = reduceAngle(angleRad, angleStdRad);
+  angleStdRad *= signVal;
+
+  if (!(maxAbsError > 0.0))
+  {
+    cout << "ERROR: Invalid input - tolerance must be positive!" << endl;
+    doSuccess = false;
+  }
+  else
+  {
+    // x^(2i + 1) is carried from term to term; "termVal" is always the
+    // next term, i.e. the bound on what is still missing
+    angleSqrVal = angleStdRad * angleStdRad;
+    anglePowVal = angleStdRad;
+    termVal = angleStdRad;
+    sumTermVal = 0.0;
+    numTerms = 0;
+    do
+    {
+      sumTermVal += termVal;
+      numTerms++;
+      anglePowVal *= angleSqrVal;
+      if (numTerms < MAX_SERIES_NUM_TERM)
+      {
+        termVal = SINE_COEF[numTerms] * anglePowVal;
+      }
+    } while (numTerms < MAX_SERIES_NUM_TERM &&
+             (termVal > maxAbsError || termVal < -maxAbsError));
+
+    outSineVal = sumTermVal;
+    outNumTerms = numTerms;
+  }
+
+  return doSuccess;
+}
+
+bool approximateSinCos(const double angleRad, const int numTerms,
+                       double& outSineVal, double& outCosineVal)
+{
+  double angleStdRad;
+  double angleSqrVal;
+  double sumSineVal;
+  double sumCosineVal;
+  bool doSuccess;
+  int signVal;
+
+  doSuccess = true;
+  // sin(x + kπ) = (-1)^k sin(x) and cos(x + kπ) = (-1)^k cos(x); the sign
+  // moves onto the angle for the (odd) sine, and onto the result for the
+  // (even) cosine
+  signVal = reduceAngle(angleRad, angleStdRad);
+  angleStdRad *= signVal;
+
+  if (!checkNumTerms(numTerms))
+  {
+    doSuccess = false;
+  }
+  else
+  {
+    // both series are polynomials in x^2; one loop keeps the two Horner
+    // chains independent so they can overlap
+    angleSqrVal = angleStdRad * angleStdRad;
+    sumSineVal = SINE_COEF[numTerms - 1];
+    sumCosineVal = COSINE_COEF[numTerms - 1];
+    for (int i = numTerms - 2; i >= 0; i--)
     {
-      angleStdRad -= 2* PI_VALUE;
+      sumSineVal = sumSineVal * angleSqrVal + SINE_COEF[i];
+      sumCosineVal = sumCosineVal * angleSqrVal + COSINE_COEF[i];
     }
+    outSineVal = sumSineVal * angleStdRad;
+    outCosineVal = sumCosineVal * signVal;
   }
-  
-  // approximate the sine value
-  sumTermVal = 0.0;
-  negBaseVal = -1.0;
-  
+
+  return doSuccess;
+}
+
+bool checkNumTerms(const int numTerms)
+{
+  bool isValid;
+
+  isValid = true;
+
   if (numTerms < MIN_NUM_TERM || numTerms > MAX_NUM_TERM)
   {
     cout << "ERROR: Invalid input - must respond with value between "
          << MIN_NUM_TERM << " and " << MAX_NUM_TERM << "!" << endl;
-    doSuccess = false;
+    isValid = false;
+  }
+
+  return isValid;
+}
+
+double roundToNearest(const double inVal)
+{
+  double roundVal;
+
+  // adding 2^52 pushes the fraction bits out of the double, so the FPU
+  // rounds for us
+  if (inVal >= ROUND_MAGIC_VAL || inVal <= -ROUND_MAGIC_VAL)
+  {
+    roundVal = inVal;
+  }
+  else if (inVal >= 0)
+  {
+    roundVal = (inVal + ROUND_MAGIC_VAL) - ROUND_MAGIC_VAL;
   }
   else
   {
-    for (int i = 0; i < numTerms; i++)
+    roundVal = (inVal - ROUND_MAGIC_VAL) + ROUND_MAGIC_VAL;
+  }
+
+  return roundVal;
+}
+
+//This function is "reduceAngle" for finite angles too large for the
+//Cody-Waite split. The angle is m * 2^e with a 53-bit whole m, so
+//angle / π is m times the bits of 1/π shifted by e; bits that land at or
+//above the 2s place only add even multiples of π and are skipped, which
+//leaves a window of PAYNE_HANEK_NUM_WORDS words whatever the size.
+static int reduceLargeAngle(const double angleRad, double& outReducedRad)
+{
+  // product of m and the window, least significant word first, with
+  // spare zero words so every bit read below is in the array
+  uint32_t prodWords[PAYNE_HANEK_NUM_WORDS + 3];
+  uint64_t angleBits;
+  uint64_t mantVal;
+  uint64_t mantLo;
+  uint64_t mantHi;
+  uint64_t lowPart;
+  uint64_t highPart;
+  uint64_t sumVal;
+  uint64_t carryVal;
+  uint64_t fracHi; // first 64 bits after the binary point of angle / π
+  uint64_t fracLo; // next 64 bits
+  double fracVal;
+  int expVal; // |angleRad| = mantVal * 2^expVal
+  int firstWord; // first word of 1/π in the window
+  int unitBit; // bit at the 1s place, i.e. angle / π mod 2 rounded down
+  int unitPos; // bit of "prodWords" at the 1s place
+  int wordIndex;
+  int bitOffset;
+  int signVal;
+  bool isRoundedUp;
+
+  memcpy(&angleBits, &angleRad, sizeof(angleBits));
+  expVal = (int)((angleBits >> 52) & 0x7FF) - 1075;
+  mantVal = (angleBits & (((uint64_t)1 << 52) - 1)) | ((uint64_t)1 << 52);
+  mantLo = mantVal & 0xFFFFFFFF;
+  mantHi = mantVal >> 32;
+
+  // word j holds bits 32j + 1 to 32j + 32 of 1/π; times 2^e, a whole word
+  // ending at or above the 2s place only adds even numbers
+  firstWord = expVal > 32 ? (expVal - 1) / 32 : 0;
+  unitPos = 32 * (firstWord + PAYNE_HANEK_NUM_WORDS) - expVal;
+
+  carryVal = 0;
+  for (int p = 0; p < PAYNE_HANEK_NUM_WORDS + 3; p++)
+  {
+    lowPart = 0;
+    highPart = 0;
+    if (p < PAYNE_HANEK_NUM_WORDS)
+    {
+      lowPart = mantLo *
+                INV_PI_BITS[firstWord + PAYNE_HANEK_NUM_WORDS - 1 - p];
+    }
+    if (p >= 1 && p <= PAYNE_HANEK_NUM_WORDS)
+    {
+      highPart = mantHi *
+                 INV_PI_BITS[firstWord + PAYNE_HANEK_NUM_WORDS - p];
+    }
+    sumVal = carryVal + (lowPart & 0xFFFFFFFF) + (highPart & 0xFFFFFFFF);
+    prodWords[p] = (uint32_t)sumVal;
+    carryVal = (sumVal >> 32) + (lowPart >> 32) + (highPart >> 32);
+  }
+
+  unitBit = (prodWords[unitPos / 32] >> (unitPos % 32)) & 1;
+  wordIndex = (unitPos - 64) / 32;
+  bitOffset = (unitPos - 64) % 32;
+  fracHi = (((uint64_t)prodWords[wordIndex + 1] << 32 |
+             prodWords[wordIndex]) >> bitOffset);
+  if (bitOffset > 0)
+  {
+    fracHi |= (uint64_t)prodWords[wordIndex + 2] << (64 - bitOffset);
+  }
+  wordIndex -= 2;
+  fracLo = (((uint64_t)prodWords[wordIndex + 1] << 32 |
+             prodWords[wordIndex]) >> bitOffset);
+  if (bitOffset > 0)
+  {
+    fracLo |= (uint64_t)prodWords[wordIndex + 2] << (64 - bitOffset);
+  }
+
+  // round to the nearest multiple of π: a fraction of 1/2 or more goes up
+  // to the next one, which flips the parity and leaves the remainder
+  // 1 - fraction below it
+  signVal = unitBit != 0 ? -1 : 1;
+  isRoundedUp = (fracHi >> 63) != 0;
+  if (isRoundedUp)
+  {
+    signVal = -signVal;
+    fracLo = ~fracLo + 1;
+    fracHi = ~fracHi + (fracLo == 0 ? 1 : 0);
+  }
+  fracVal = ((double)fracHi + (double)fracLo * TWO_POW_MINUS_64) *
+            TWO_POW_MINUS_64;
+  // sin(-x) = -sin(x), so a negative angle keeps the sign and negates the
+  // remainder
+  if (isRoundedUp != ((angleBits >> 63) != 0))
+  {
+    fracVal = -fracVal;
+  }
+
+  outReducedRad = fracVal * (2.0 * HALF_PI_VALUE);
+
+  return signVal;
+}
+
+int reduceAngle(const double angleRad, double& outReducedRad)
+{
+  double halfTurnVal;
+  double halfOfHalfTurn;
+  int signVal;
+
+  if (!(angleRad - angleRad == 0.0))
+  {
+    // NaN and ±infinity have no remainder; x - x is NaN for both
+    outReducedRad = angleRad - angleRad;
+    signVal = 1;
+  }
+  else if (angleRad > CODY_WAITE_MAX_RAD || angleRad < -CODY_WAITE_MAX_RAD)
+  {
+    signVal = reduceLargeAngle(angleRad, outReducedRad);
+  }
+  else
+  {
+    // nearest multiple of π, then subtract it piece by piece so the large
+    // parts cancel exactly
+    halfTurnVal = roundToNearest(angleRad * INV_PI_VALUE);
+    outReducedRad = angleRad - halfTurnVal * PI_PART_1;
+    outReducedRad -= halfTurnVal * PI_PART_2;
+    outReducedRad -= halfTurnVal * PI_PART_3;
+    outReducedRad -= halfTurnVal * PI_PART_4;
+
+    // odd multiples of π flip the sign
+    halfOfHalfTurn = halfTurnVal * 0.5;
+    if (roundToNearest(halfOfHalfTurn) != halfOfHalfTurn)
+    {
+      signVal = -1;
+    }
+    else
+    {
+      signVal = 1;
+    }
+  }
+
+  return signVal;
+}
+
+bool runSineBatch(istream& inStream, ostream& outStream)
+{
+  static char inBuffer[BATCH_BUFFER_SIZE + 1];
+  static char outBuffer[BATCH_BUFFER_SIZE + BATCH_MAX_LINE_SIZE];
+  char* readPos;
+  char* endPos;
+  char* lineEnd;
+  char* parseEnd;
+  char angleType;
+  double angleInputVal;
+  double angleStdVal;
+  double sineVal;
+  int numInBuffer;
+  int numOutBuffer;
+  int recordNum;
+  long numTerm;
+  bool isEndOfInput;
+  bool doSuccess;
+
+  doSuccess = true;
+  isEndOfInput = false;
+  numInBuffer = 0;
+  numOutBuffer = 0;
+  recordNum = 0;
+
+  while (doSuccess && !isEndOfInput)
+  {
+    // top up the input block after whatever partial line was left over
+    inStream.read(inBuffer + numInBuffer, BATCH_BUFFER_SIZE - numInBuffer);
+    numInBuffer += inStream.gcount();
+    isEndOfInput = !inStream;
+    inBuffer[numInBuffer] = '\0';
+
+    // only whole lines are parsed, unless there is no more input
+    endPos = inBuffer + numInBuffer;
+    if (!isEndOfInput)
     {
-      negExpVal = i;
-      angleExpVal = 2 * i + 1;
-      inValFctrl = 2 * i + 1;
+      while (endPos > inBuffer && endPos[-1] != '\n')
+      {
+        endPos--;
+      }
+      if (endPos == inBuffer)
+      {
+        cerr << "ERROR: Record " << recordNum + 1 << " is too long!" << endl;
+        doSuccess = false;
+      }
+    }
 
-      doNegPow = toThePower(negBaseVal, negExpVal, coefNegPow);
-      doAnglePow = toThePower(angleStdRad, angleExpVal, coefAnglePow);
-      doFctrl = computeFactorial(inValFctrl, coefFctrl);
-      
-      if (doNegPow && doAnglePow && doFctrl)
+    readPos = inBuffer;
+    while (doSuccess && readPos < endPos)
+    {
+      lineEnd = readPos;
+      while (lineEnd < endPos && *lineEnd != '\n')
       {
-        sumTermVal += coefNegPow * coefAnglePow / coefFctrl;
+        lineEnd++;
       }
-      else
+      while (readPos < lineEnd && isspace(*readPos))
+      {
+        readPos++;
+      }
+      if (readPos == lineEnd)
+      {
+        // blank line
+        readPos = lineEnd + 1;
+        continue;
+      }
+
+      recordNum++;
+      angleType = *readPos++;
+      angleInputVal = strtod(readPos, &parseEnd);
+      if (parseEnd == readPos || parseEnd > lineEnd)
       {
         doSuccess = false;
-        i = numTerms; // terminate the loop early when "doSuccess" = false
+      }
+      else
+      {
+        readPos = parseEnd;
+        numTerm = strtol(readPos, &parseEnd, 10);
+        if (parseEnd == readPos || parseEnd > lineEnd)
+        {
+          doSuccess = false;
+        }
+        else
+        {
+          // nothing but spaces may follow the number of terms
+          readPos = parseEnd;
+          while (readPos < lineEnd && isspace(*readPos))
+          {
+            readPos++;
+          }
+          doSuccess = readPos == lineEnd;
+        }
+      }
+      if (!doSuccess)
+      {
+        cerr << "ERROR: Unable to parse record " << recordNum << "!" << endl;
+        break;
+      }
+      readPos = lineEnd + 1;
+
+      // range is checked here so "approximateSine" never prints into the
+      // result stream
+      if ((angleType != TYPE_DEGREE && angleType != TYPE_RADIAN) ||
+          numTerm < MIN_NUM_TERM || numTerm > MAX_NUM_TERM)
+      {
+        numOutBuffer += sprintf(outBuffer + numOutBuffer, "%s\n",
+                                BATCH_INVALID_TEXT.c_str());
+      }
+      else
+      {
+        if (angleType == TYPE_DEGREE)
+        {
+          angleStdVal = degreesToRadians(angleInputVal);
+        }
+        else
+        {
+          angleStdVal = angleInputVal;
+        }
+        approximateSine(angleStdVal, numTerm, sineVal);
+        // "%g" prints the same digits as the default "cout << sineVal"
+        numOutBuffer += sprintf(outBuffer + numOutBuffer, "%g\n", sineVal);
+      }
+
+      if (numOutBuffer >= BATCH_BUFFER_SIZE)
+      {
+        outStream.write(outBuffer, numOutBuffer);
+        numOutBuffer = 0;
       }
     }
+
+    // keep the unparsed tail for the next block
+    numInBuffer = inBuffer + numInBuffer - endPos;
+    memmove(inBuffer, endPos, numInBuffer);
+  }
+  outStream.write(outBuffer, numOutBuffer);
+  outStream.flush();
+
+  return doSuccess;
+}
+
+// --- Lookup table ---
+// Sine values at evenly spaced angles from 0 to π/2, plus
+// SINE_TABLE_GUARD_SIZE entries past the end
+static double* sineTableVals = 0;
+static int sineTableSize = 0;
+static double sineTableInvStep = 0.0;
+
+bool initSineTable(const int numEntries)
+{
+  double stepVal;
+  int numTerms;
+  bool doSuccess;
+
+  doSuccess = true;
+
+  if (numEntries < MIN_SINE_TABLE_SIZE)
+  {
+    cout << "ERROR: Invalid input - table needs at least "
+         << MIN_SINE_TABLE_SIZE << " entries!" << endl;
+    doSuccess = false;
   }
-  // assign approximation to "outSineVal"
-  if (doSuccess)
+  else
   {
-    outSineVal = sumTermVal;
+    releaseSineTable();
+    sineTableVals = new double[numEntries + SINE_TABLE_GUARD_SIZE];
+    sineTableSize = numEntries;
+    stepVal = HALF_PI_VALUE / (numEntries - 1);
+    sineTableInvStep = 1.0 / stepVal;
+
+    // entries are built to full double accuracy, so the interpolation is
+    // the only error left
+    for (int i = 0; i < numEntries + SINE_TABLE_GUARD_SIZE; i++)
+    {
+      approximateSineToTolerance(i * stepVal, SINE_TABLE_BUILD_TOLERANCE,
+                                 sineTableVals[i], numTerms);
+    }
   }
-  
+
+  return doSuccess;
+}
+
+void releaseSineTable()
+{
+  delete [] sineTableVals;
+  sineTableVals = 0;
+  sineTableSize = 0;
+}
+
+bool approximateSineTable(const double angleRad, const int interpMode,
+                          double& outSineVal)
+{
+  double angleStdRad;
+  double posVal; // position in units of the table spacing
+  double fracVal;
+  double diffVal;
+  double diffSqrVal;
+  bool doSuccess;
+  int signVal;
+  int indexVal;
+
+  doSuccess = true;
+
+  if (interpMode != INTERP_LINEAR && interpMode != INTERP_QUADRATIC)
+  {
+    cout << "ERROR: Invalid input - unknown interpolation mode!" << endl;
+    doSuccess = false;
+  }
+  else if (!(angleRad - angleRad == 0.0))
+  {
+    // x - x is NaN for NaN and ±infinity
+    cout << "ERROR: Invalid input - angle must be finite!" << endl;
+    doSuccess = false;
+  }
+  else
+  {
+    // not thread-safe; see the declaration
+    if (sineTableVals == 0)
+    {
+      initSineTable(DEFAULT_SINE_TABLE_SIZE);
+    }
+
+    // the table only covers [0, π/2], and sine is odd
+    signVal = reduceAngle(angleRad, angleStdRad);
+    if (angleStdRad < 0)
+    {
+      angleStdRad = -angleStdRad;
+      signVal = -signVal;
+    }
+
+    posVal = angleStdRad * sineTableInvStep;
+    // clamp before the cast as well, so no position can overflow the int
+    // or index outside the table
+    if (posVal > sineTableSize - 1)
+    {
+      posVal = sineTableSize - 1;
+    }
+    else if (posVal < 0.0)
+    {
+      posVal = 0.0;
+    }
+    indexVal = (int)posVal;
+    fracVal = posVal - indexVal;
+
+    // Newton forward differences from entry "indexVal"
+    diffVal = sineTableVals[indexVal + 1] - sineTableVals[indexVal];
+    if (interpMode == INTERP_LINEAR)
+    {
+      outSineVal = sineTableVals[indexVal] + fracVal * diffVal;
+    }
+    else
+    {
+      diffSqrVal = sineTableVals[indexVal + 2] - sineTableVals[indexVal + 1] -
+                   diffVal;
+      outSineVal = sineTableVals[indexVal] + fracVal *
+                   (diffVal + 0.5 * (fracVal - 1.0) * diffSqrVal);
+    }
+    outSineVal *= signVal;
+  }
+
+  return doSuccess;
+}
+
+// --- Batch kernels ---
+// Each kernel overwrites the standardized angles in "ioVals" with their
+// sine, using the same Horner evaluation (and operation order) as
+// "approximateSine".
+
+static void sineKernelScalar(double ioVals[], const int numVals,
+                             const int numTerms)
+{
+  for (int k = 0; k < numVals; k++)
+  {
+    double angleVal = ioVals[k];
+    double angleSqrVal = angleVal * angleVal;
+    double sumTermVal = SINE_COEF[numTerms - 1];
+
+    for (int i = numTerms - 2; i >= 0; i--)
+    {
+      sumTermVal = sumTermVal * angleSqrVal + SINE_COEF[i];
+    }
+    ioVals[k] = sumTermVal * angleVal;
+  }
+}
+
+#ifdef SINE_X86_SIMD
+static void sineKernelSse2(double ioVals[], const int numVals,
+                           const int numTerms)
+{
+  const int numLanes = 2;
+  int k;
+
+  for (k = 0; k + numLanes <= numVals; k += numLanes)
+  {
+    __m128d angleVec = _mm_loadu_pd(ioVals + k);
+    __m128d angleSqrVec = _mm_mul_pd(angleVec, angleVec);
+    __m128d sumTermVec = _mm_set1_pd(SINE_COEF[numTerms - 1]);
+
+    for (int i = numTerms - 2; i >= 0; i--)
+    {
+      sumTermVec = _mm_add_pd(_mm_mul_pd(sumTermVec, angleSqrVec),
+                              _mm_set1_pd(SINE_COEF[i]));
+    }
+    _mm_storeu_pd(ioVals + k, _mm_mul_pd(sumTermVec, angleVec));
+  }
+  sineKernelScalar(ioVals + k, numVals - k, numTerms);
+}
+
+__attribute__((target("avx2")))
+static void sineKernelAvx2(double ioVals[], const int numVals,
+                           const int numTerms)
+{
+  const int numLanes = 4;
+  int k;
+
+  for (k = 0; k + numLanes <= numVals; k += numLanes)
+  {
+    __m256d angleVec = _mm256_loadu_pd(ioVals + k);
+    __m256d angleSqrVec = _mm256_mul_pd(angleVec, angleVec);
+    __m256d sumTermVec = _mm256_set1_pd(SINE_COEF[numTerms - 1]);
+
+    for (int i = numTerms - 2; i >= 0; i--)
+    {
+      sumTermVec = _mm256_add_pd(_mm256_mul_pd(sumTermVec, angleSqrVec),
+                                 _mm256_set1_pd(SINE_COEF[i]));
+    }
+    _mm256_storeu_pd(ioVals + k, _mm256_mul_pd(sumTermVec, angleVec));
+  }
+  sineKernelScalar(ioVals + k, numVals - k, numTerms);
+}
+#endif
+
+// Each sincos kernel reads the standardized angles from "ioSineVals" and
+// the reduction signs from "ioCosineVals", and overwrites them with the
+// sine and cosine, in the same operation order as "approximateSinCos".
+
+static void sinCosKernelScalar(double ioSineVals[], double ioCosineVals[],
+                               const int numVals, const int numTerms)
+{
+  for (int k = 0; k < numVals; k++)
+  {
+    double angleVal = ioSineVals[k];
+    double angleSqrVal = angleVal * angleVal;
+    double sumSineVal = SINE_COEF[numTerms - 1];
+    double sumCosineVal = COSINE_COEF[numTerms - 1];
+
+    for (int i = numTerms - 2; i >= 0; i--)
+    {
+      sumSineVal = sumSineVal * angleSqrVal + SINE_COEF[i];
+      sumCosineVal = sumCosineVal * angleSqrVal + COSINE_COEF[i];
+    }
+    ioSineVals[k] = sumSineVal * angleVal;
+    ioCosineVals[k] = sumCosineVal * ioCosineVals[k];
+  }
+}
+
+#ifdef SINE_X86_SIMD
+static void sinCosKernelSse2(double ioSineVals[], double ioCosineVals[],
+                             const int numVals, const int numTerms)
+{
+  const int numLanes = 2;
+  int k;
+
+  for (k = 0; k + numLanes <= numVals; k += numLanes)
+  {
+    __m128d angleVec = _mm_loadu_pd(ioSineVals + k);
+    __m128d angleSqrVec = _mm_mul_pd(angleVec, angleVec);
+    __m128d sumSineVec = _mm_set1_pd(SINE_COEF[numTerms - 1]);
+    __m128d sumCosineVec = _mm_set1_pd(COSINE_COEF[numTerms - 1]);
+
+    for (int i = numTerms - 2; i >= 0; i--)
+    {
+      sumSineVec = _mm_add_pd(_mm_mul_pd(sumSineVec, angleSqrVec),
+                              _mm_set1_pd(SINE_COEF[i]));
+      sumCosineVec = _mm_add_pd(_mm_mul_pd(sumCosineVec, angleSqrVec),
+                                _mm_set1_pd(COSINE_COEF[i]));
+    }
+    _mm_storeu_pd(ioSineVals + k, _mm_mul_pd(sumSineVec, angleVec));
+    _mm_storeu_pd(ioCosineVals + k,
+                  _mm_mul_pd(sumCosineVec, _mm_loadu_pd(ioCosineVals + k)));
+  }
+  sinCosKernelScalar(ioSineVals + k, ioCosineVals + k, numVals - k,
+                     numTerms);
+}
+
+__attribute__((target("avx2")))
+static void sinCosKernelAvx2(double ioSineVals[], double ioCosineVals[],
+                             const int numVals, const int numTerms)
+{
+  const int numLanes = 4;
+  int k;
+
+  for (k = 0; k + numLanes <= numVals; k += numLanes)
+  {
+    __m256d angleVec = _mm256_loadu_pd(ioSineVals + k);
+    __m256d angleSqrVec = _mm256_mul_pd(angleVec, angleVec);
+    __m256d sumSineVec = _mm256_set1_pd(SINE_COEF[numTerms - 1]);
+    __m256d sumCosineVec = _mm256_set1_pd(COSINE_COEF[numTerms - 1]);
+
+    for (int i = numTerms - 2; i >= 0; i--)
+    {
+      sumSineVec = _mm256_add_pd(_mm256_mul_pd(sumSineVec, angleSqrVec),
+                                 _mm256_set1_pd(SINE_COEF[i]));
+      sumCosineVec = _mm256_add_pd(_mm256_mul_pd(sumCosineVec, angleSqrVec),
+                                   _mm256_set1_pd(COSINE_COEF[i]));
+    }
+    _mm256_storeu_pd(ioSineVals + k, _mm256_mul_pd(sumSineVec, angleVec));
+    _mm256_storeu_pd(ioCosineVals + k,
+                     _mm256_mul_pd(sumCosineVec,
+                                   _mm256_loadu_pd(ioCosineVals + k)));
+  }
+  sinCosKernelScalar(ioSineVals + k, ioCosineVals + k, numVals - k,
+                     numTerms);
+}
+#endif
+
+typedef void (*SineKernelType)(double ioVals[], const int numVals,
+                               const int numTerms);
+typedef void (*SinCosKernelType)(double ioSineVals[], double ioCosineVals[],
+                                 const int numVals, const int numTerms);
+
+// Pick the widest kernel the running CPU supports
+static SineKernelType selectSineKernel()
+{
+  SineKernelType kernelFunc;
+
+  kernelFunc = sineKernelScalar;
+#ifdef SINE_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+  {
+    kernelFunc = sineKernelAvx2;
+  }
+  else
+  {
+    kernelFunc = sineKernelSse2;
+  }
+#endif
+
+  return kernelFunc;
+}
+
+// Same choice as "selectSineKernel", for the sincos kernels
+static SinCosKernelType selectSinCosKernel()
+{
+  SinCosKernelType kernelFunc;
+
+  kernelFunc = sinCosKernelScalar;
+#ifdef SINE_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+  {
+    kernelFunc = sinCosKernelAvx2;
+  }
+  else
+  {
+    kernelFunc = sinCosKernelSse2;
+  }
+#endif
+
+  return kernelFunc;
+}
+
+bool approximateSineBatch(const double anglesRad[], const int numAngles,
+                          const int numTerms, double outSineVals[])
+{
+  static const SineKernelType kernelFunc = selectSineKernel();
+  bool doSuccess;
+
+  doSuccess = true;
+
+  if (!checkNumTerms(numTerms))
+  {
+    doSuccess = false;
+  }
+  else if (numAngles < 0)
+  {
+    doSuccess = false;
+  }
+  else
+  {
+    for (int k = 0; k < numAngles; k++)
+    {
+      double reducedRad;
+      int signVal = reduceAngle(anglesRad[k], reducedRad);
+      outSineVals[k] = signVal * reducedRad;
+    }
+    kernelFunc(outSineVals, numAngles, numTerms);
+  }
+
+  return doSuccess;
+}
+
+bool approximateSinCosBatch(const double anglesRad[], const int numAngles,
+                            const int numTerms, double outSineVals[],
+                            double outCosineVals[])
+{
+  static const SinCosKernelType kernelFunc = selectSinCosKernel();
+  bool doSuccess;
+
+  doSuccess = true;
+
+  if (!checkNumTerms(numTerms))
+  {
+    doSuccess = false;
+  }
+  else if (numAngles < 0)
+  {
+    doSuccess = false;
+  }
+  else
+  {
+    for (int k = 0; k < numAngles; k++)
+    {
+      double reducedRad;
+      int signVal = reduceAngle(anglesRad[k], reducedRad);
+      outSineVals[k] = signVal * reducedRad;
+      outCosineVals[k] = signVal;
+    }
+    kernelFunc(outSineVals, outCosineVals, numAngles, numTerms);
+  }
+
+  return doSuccess;
+}
+
+// --- Parallel sweep ---
+
+// One run of chunks. "nextChunk" is the next unclaimed chunk, claimed
+// with an atomic add by the owner or by a thief; the padding gives every
+// run a cache line of its own, so claims on different runs do not fight
+// over the same line.
+struct SweepRunType
+{
+  long nextChunk;
+  long endChunk; // one past the last chunk of the run
+  char linePadding[CACHE_LINE_SIZE - 2 * sizeof(long)];
+};
+
+// What every sweep thread shares. Chunks are dealt out as one contiguous
+// run per thread, "runs[t]" for thread "t".
+struct SweepJobType
+{
+  double startRad;
+  double stepRad;
+  long numAngles;
+  long headSize; // angles before the first cache-line boundary
+  int numTerms;
+  int numThreads;
+  double* outSineVals;
+  // keeps the fields above, read on every chunk, off the line of run 0
+  char headPadding[CACHE_LINE_SIZE];
+  SweepRunType runs[MAX_SWEEP_THREADS];
+};
+
+struct SweepWorkerType
+{
+  SweepJobType* jobPtr;
+  int threadIndex;
+};
+
+//This function computes chunk "chunkIndex" of the sweep in "jobPtr".
+static void runSweepChunk(SweepJobType* jobPtr, const long chunkIndex)
+{
+  long firstIndex;
+  long lastIndex; // one past the end
+
+  firstIndex = chunkIndex == 0 ? 0 :
+               jobPtr->headSize + chunkIndex * SWEEP_CHUNK_SIZE;
+  lastIndex = jobPtr->headSize + (chunkIndex + 1) * SWEEP_CHUNK_SIZE;
+  if (lastIndex > jobPtr->numAngles)
+  {
+    lastIndex = jobPtr->numAngles;
+  }
+
+  // angles straight from the index, never a running sum, so the split
+  // into chunks cannot change them
+  for (long i = firstIndex; i < lastIndex; i++)
+  {
+    jobPtr->outSineVals[i] = jobPtr->startRad + i * jobPtr->stepRad;
+  }
+  approximateSineBatch(jobPtr->outSineVals + firstIndex,
+                       (int)(lastIndex - firstIndex), jobPtr->numTerms,
+                       jobPtr->outSineVals + firstIndex);
+}
+
+//This function is the body of one sweep thread: it works through its own
+//run of chunks, then steals from the other runs until none are left.
+static void* runSweepWorker(void* workerArg)
+{
+  SweepWorkerType* workerPtr = (SweepWorkerType*)workerArg;
+  SweepJobType* jobPtr = workerPtr->jobPtr;
+  long chunkIndex;
+  int victimIndex;
+
+  for (int i = 0; i < jobPtr->numThreads; i++)
+  {
+    victimIndex = (workerPtr->threadIndex + i) % jobPtr->numThreads;
+    while (true)
+    {
+#ifdef SINE_THREADS
+      chunkIndex = __sync_fetch_and_add(&jobPtr->runs[victimIndex].nextChunk,
+                                        1);
+#else
+      chunkIndex = jobPtr->runs[victimIndex].nextChunk++;
+#endif
+      if (chunkIndex >= jobPtr->runs[victimIndex].endChunk)
+      {
+        break;
+      }
+      runSweepChunk(jobPtr, chunkIndex);
+    }
+  }
+
+  return 0;
+}
+
+bool approximateSineSweep(const double startRad, const double stepRad,
+                          const long numAngles, const int numTerms,
+                          const int numThreads, double outSineVals[])
+{
+  SweepJobType sweepJob;
+  SweepWorkerType workers[MAX_SWEEP_THREADS];
+  long numChunks;
+  long alignOffset;
+  bool doSuccess;
+  int numWorkers;
+
+  doSuccess = true;
+
+  if (!checkNumTerms(numTerms))
+  {
+    doSuccess = false;
+  }
+  else if (numAngles < 0 || numThreads < 0)
+  {
+    doSuccess = false;
+  }
+  else if (numAngles > 0)
+  {
+    // the first chunk absorbs the angles up to the first cache line
+    alignOffset = (long)((size_t)outSineVals % CACHE_LINE_SIZE);
+    sweepJob.headSize = alignOffset == 0 ? 0 :
+                        (CACHE_LINE_SIZE - alignOffset) / (long)sizeof(double);
+    if (sweepJob.headSize > numAngles)
+    {
+      sweepJob.headSize = numAngles;
+    }
+    numChunks = (numAngles - sweepJob.headSize + SWEEP_CHUNK_SIZE - 1) /
+                SWEEP_CHUNK_SIZE;
+    if (numChunks == 0)
+    {
+      numChunks = 1;
+    }
+
+    numWorkers = numThreads;
+#ifdef SINE_THREADS
+    if (numWorkers == 0)
+    {
+      numWorkers = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    }
+#else
+    numWorkers = 1;
+#endif
+    if (numWorkers < 1)
+    {
+      numWorkers = 1;
+    }
+    if (numWorkers > MAX_SWEEP_THREADS)
+    {
+      numWorkers = MAX_SWEEP_THREADS;
+    }
+    if (numWorkers > numChunks)
+    {
+      numWorkers = (int)numChunks;
+    }
+
+    sweepJob.startRad = startRad;
+    sweepJob.stepRad = stepRad;
+    sweepJob.numAngles = numAngles;
+    sweepJob.numTerms = numTerms;
+    sweepJob.numThreads = numWorkers;
+    sweepJob.outSineVals = outSineVals;
+    for (int t = 0; t < numWorkers; t++)
+    {
+      sweepJob.runs[t].nextChunk = numChunks * t / numWorkers;
+      sweepJob.runs[t].endChunk = numChunks * (t + 1) / numWorkers;
+      workers[t].jobPtr = &sweepJob;
+      workers[t].threadIndex = t;
+    }
+
+#ifdef SINE_THREADS
+    pthread_t threadIds[MAX_SWEEP_THREADS];
+    int numStarted;
+
+    // this thread is worker 0; if a thread cannot start, the others steal
+    // its run
+    numStarted = 1;
+    for (int t = 1; t < numWorkers; t++)
+    {
+      if (pthread_create(&threadIds[numStarted], 0, runSweepWorker,
+                         &workers[t]) == 0)
+      {
+        numStarted++;
+      }
+    }
+    runSweepWorker(&workers[0]);
+    for (int t = 1; t < numStarted; t++)
+    {
+      pthread_join(threadIds[t], 0);
+    }
+#else
+    runSweepWorker(&workers[0]);
+#endif
+  }
+
+  return doSuccess;
+}
+
+// --- Fixed point ---
+
+//This function divides "inVal" by 2^"shiftVal", rounding to nearest (ties
+//up). It is written without shifting negative numbers, whose result C++
+//leaves to the compiler, but matches an arithmetic shift of "inVal" + half.
+static int32_t shiftRoundQ15(const int32_t inVal, const int shiftVal)
+{
+  int32_t sumVal;
+
+  sumVal = inVal + ((int32_t)1 << (shiftVal - 1));
+
+  return sumVal >= 0 ? (sumVal >> shiftVal) :
+         -((-sumVal + ((int32_t)1 << shiftVal) - 1) >> shiftVal);
+}
+
+//This function is "shiftRoundQ15" for 64-bit values.
+static int64_t shiftRoundQ31(const int64_t inVal, const int shiftVal)
+{
+  int64_t sumVal;
+
+  sumVal = inVal + ((int64_t)1 << (shiftVal - 1));
+
+  return sumVal >= 0 ? (sumVal >> shiftVal) :
+         -((-sumVal + ((int64_t)1 << shiftVal) - 1) >> shiftVal);
+}
+
+int16_t approximateSineQ15(const int16_t angleQ15)
+{
+  int32_t angleStdVal;
+  int32_t angleSqrVal;
+  int32_t sumTermVal;
+  int32_t sineVal;
+  bool isFlipped;
+
+  // sin(x ± π) = -sin(x) folds the angle into -π/2 to +π/2
+  angleStdVal = angleQ15;
+  isFlipped = false;
+  if (angleStdVal > Q15_QUARTER_TURN)
+  {
+    angleStdVal -= Q15_ONE;
+    isFlipped = true;
+  }
+  else if (angleStdVal < -Q15_QUARTER_TURN)
+  {
+    angleStdVal += Q15_ONE;
+    isFlipped = true;
+  }
+
+  // y = 2 * angle in Q15, then the series in y^2 as in "approximateSine"
+  angleStdVal *= 2;
+  angleSqrVal = shiftRoundQ15(angleStdVal * angleStdVal, 15);
+  sumTermVal = SINE_COEF_Q15[FIXED_Q15_NUM_TERM - 1];
+  for (int i = FIXED_Q15_NUM_TERM - 2; i >= 0; i--)
+  {
+    sumTermVal = shiftRoundQ15(sumTermVal * angleSqrVal, 15) +
+                 SINE_COEF_Q15[i];
+  }
+  sineVal = shiftRoundQ15(sumTermVal * angleStdVal, 15);
+
+  if (isFlipped)
+  {
+    sineVal = -sineVal;
+  }
+  if (sineVal > Q15_MAX_VAL)
+  {
+    sineVal = Q15_MAX_VAL;
+  }
+  else if (sineVal < Q15_MIN_VAL)
+  {
+    sineVal = Q15_MIN_VAL;
+  }
+
+  return (int16_t)sineVal;
+}
+
+int32_t approximateSineQ31(const int32_t angleQ31)
+{
+  int64_t angleStdVal;
+  int64_t angleSqrVal;
+  int64_t sumTermVal;
+  int64_t sineVal;
+  bool isFlipped;
+
+  angleStdVal = angleQ31;
+  isFlipped = false;
+  if (angleStdVal > Q31_QUARTER_TURN)
+  {
+    angleStdVal -= Q31_ONE;
+    isFlipped = true;
+  }
+  else if (angleStdVal < -Q31_QUARTER_TURN)
+  {
+    angleStdVal += Q31_ONE;
+    isFlipped = true;
+  }
+
+  // every product is below 2^63: |sum| < 1.6 * 2^31 and y^2 <= 2^31
+  angleStdVal *= 2;
+  angleSqrVal = shiftRoundQ31(angleStdVal * angleStdVal, 31);
+  sumTermVal = SINE_COEF_Q31[FIXED_Q31_NUM_TERM - 1];
+  for (int i = FIXED_Q31_NUM_TERM - 2; i >= 0; i--)
+  {
+    sumTermVal = shiftRoundQ31(sumTermVal * angleSqrVal, 31) +
+                 SINE_COEF_Q31[i];
+  }
+  sineVal = shiftRoundQ31(sumTermVal * angleStdVal, 31);
+
+  if (isFlipped)
+  {
+    sineVal = -sineVal;
+  }
+  if (sineVal > Q31_MAX_VAL)
+  {
+    sineVal = Q31_MAX_VAL;
+  }
+  else if (sineVal < Q31_MIN_VAL)
+  {
+    sineVal = Q31_MIN_VAL;
+  }
+
+  return (int32_t)sineVal;
+}
+
+static void sineQ15KernelScalar(const int16_t anglesQ15[], const int numVals,
+                                int16_t outSineVals[])
+{
+  for (int k = 0; k < numVals; k++)
+  {
+    outSineVals[k] = approximateSineQ15(anglesQ15[k]);
+  }
+}
+
+#ifdef SINE_X86_SIMD
+// Same steps as "approximateSineQ15" on eight 32-bit lanes; the arithmetic
+// right shift of (value + half) is exactly "shiftRoundQ15"
+__attribute__((target("avx2")))
+static void sineQ15KernelAvx2(const int16_t anglesQ15[], const int numVals,
+                              int16_t outSineVals[])
+{
+  const int numLanes = 8;
+  const __m256i oneVec = _mm256_set1_epi32(Q15_ONE);
+  const __m256i halfVec = _mm256_set1_epi32(1 << 14);
+  const __m256i upperVec = _mm256_set1_epi32(Q15_QUARTER_TURN);
+  const __m256i lowerVec = _mm256_set1_epi32(-Q15_QUARTER_TURN);
+  int k;
+
+  for (k = 0; k + numLanes <= numVals; k += numLanes)
+  {
+    __m256i angleVec = _mm256_cvtepi16_epi32(
+        _mm_loadu_si128((const __m128i*)(anglesQ15 + k)));
+    __m256i aboveMask = _mm256_cmpgt_epi32(angleVec, upperVec);
+    __m256i belowMask = _mm256_cmpgt_epi32(lowerVec, angleVec);
+    __m256i flipMask = _mm256_or_si256(aboveMask, belowMask);
+    __m256i angleSqrVec;
+    __m256i sumTermVec;
+    __m256i sineVec;
+
+    angleVec = _mm256_sub_epi32(angleVec, _mm256_and_si256(aboveMask, oneVec));
+    angleVec = _mm256_add_epi32(angleVec, _mm256_and_si256(belowMask, oneVec));
+    angleVec = _mm256_slli_epi32(angleVec, 1);
+
+    angleSqrVec = _mm256_srai_epi32(
+        _mm256_add_epi32(_mm256_mullo_epi32(angleVec, angleVec), halfVec), 15);
+    sumTermVec = _mm256_set1_epi32(SINE_COEF_Q15[FIXED_Q15_NUM_TERM - 1]);
+    for (int i = FIXED_Q15_NUM_TERM - 2; i >= 0; i--)
+    {
+      sumTermVec = _mm256_srai_epi32(
+          _mm256_add_epi32(_mm256_mullo_epi32(sumTermVec, angleSqrVec),
+                           halfVec), 15);
+      sumTermVec = _mm256_add_epi32(sumTermVec,
+                                    _mm256_set1_epi32(SINE_COEF_Q15[i]));
+    }
+    sineVec = _mm256_srai_epi32(
+        _mm256_add_epi32(_mm256_mullo_epi32(sumTermVec, angleVec), halfVec),
+        15);
+
+    // negate the flipped lanes, then pack with saturation to 16 bits
+    sineVec = _mm256_sub_epi32(_mm256_xor_si256(sineVec, flipMask),
+                               flipMask);
+    _mm_storeu_si128((__m128i*)(outSineVals + k),
+                     _mm_packs_epi32(_mm256_castsi256_si128(sineVec),
+                                     _mm256_extracti128_si256(sineVec, 1)));
+  }
+  sineQ15KernelScalar(anglesQ15 + k, numVals - k, outSineVals + k);
+}
+#endif
+
+typedef void (*SineQ15KernelType)(const int16_t anglesQ15[],
+                                  const int numVals, int16_t outSineVals[]);
+
+// AVX2 if the running CPU has it; SSE2 has no 32-bit lane multiply
+static SineQ15KernelType selectSineQ15Kernel()
+{
+  SineQ15KernelType kernelFunc;
+
+  kernelFunc = sineQ15KernelScalar;
+#ifdef SINE_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+  {
+    kernelFunc = sineQ15KernelAvx2;
+  }
+#endif
+
+  return kernelFunc;
+}
+
+bool approximateSineQ15Batch(const int16_t anglesQ15[], const int numAngles,
+                             int16_t outSineVals[])
+{
+  static const SineQ15KernelType kernelFunc = selectSineQ15Kernel();
+  bool doSuccess;
+
+  doSuccess = true;
+
+  if (numAngles < 0)
+  {
+    doSuccess = false;
+  }
+  else
+  {
+    kernelFunc(anglesQ15, numAngles, outSineVals);
+  }
+
+  return doSuccess;
+}
+
+bool approximateSineQ31Batch(const int32_t anglesQ31[], const int numAngles,
+                             int32_t outSineVals[])
+{
+  bool doSuccess;
+
+  doSuccess = true;
+
+  if (numAngles < 0)
+  {
+    doSuccess = false;
+  }
+  else
+  {
+    for (int k = 0; k < numAngles; k++)
+    {
+      outSineVals[k] = approximateSineQ31(anglesQ31[k]);
+    }
+  }
+
   return doSuccess;
 }
@@ -0,0 +1,339 @@
+// Benchmark for the sine approximator. Build it in place of the normal
+// program by defining SINE_BENCH:
+//   g++ -Wall -std=c++98 -O2 -DSINE_BENCH sineApprox402.cpp -o bench.exe
+// It prints one CSV row per (function, number of terms, angle band) with
+// the time per call and, where a reference exists, the error against
+// std::sin / std::pow. Keep the output of a known-good build and diff new
+// runs against it to catch speed or accuracy regressions. The run ends
+// with a check of huge and non-finite angles against std::sin, written to
+// stderr so stdout stays one CSV table, and exits with status 1 if any of
+// them is off.
+
+#include <cmath>
+#include <ctime>
+#include <cstring>
+#include <limits>
+
+// --- Benchmark constant ---
+// Angles per band; the same set is timed over and over
+const int BENCH_NUM_ANGLES = 1 << 14;
+// Each measurement repeats until it has run at least this long
+const double BENCH_MIN_SECONDS = 0.2;
+const int BENCH_NUM_BANDS = 4;
+const char* const BENCH_BAND_NAME[BENCH_NUM_BANDS] =
+{
+  "pi",
+  "100pi",
+  "1e6",
+  "1e20"
+};
+// Angles are drawn uniformly from -limit to +limit
+const double BENCH_BAND_LIMIT[BENCH_NUM_BANDS] =
+{
+  PI_VALUE,
+  100.0 * PI_VALUE,
+  1.0e6,
+  1.0e20
+};
+const double NANOSEC_PER_SEC = 1.0e9;
+// Angles checked for full accuracy, past the Cody-Waite limit up to the
+// largest double, and the largest error allowed against std::sin
+const int CHECK_NUM_ANGLES = 10;
+const double CHECK_ANGLES[CHECK_NUM_ANGLES] =
+{
+  1.0e10,
+  -1.0e15,
+  1.0e20,
+  -3.0e50,
+  1.0e100,
+  1.0e200,
+  -1.0e300,
+  1.7976931348623157e308,
+  // 6381956970095103 * 2^797, the double closest to a multiple of π/2
+  5.319372648326541e+255,
+  -1.6e9
+};
+const double CHECK_MAX_ABS_ERR = 1.0e-15;
+const double CHECK_TOLERANCE = 1.0e-17;
+
+// Results land here so the compiler cannot drop the timed calls
+static volatile double benchSinkVal;
+
+//This function fills "outAngles" with "numAngles" angles spread uniformly
+//from -"limitVal" to +"limitVal". A fixed linear congruential generator is
+//used so every run times the same inputs.
+static void makeBenchAngles(const double limitVal, const int numAngles,
+                            double outAngles[])
+{
+  unsigned int seedVal;
+
+  seedVal = 402u;
+  for (int i = 0; i < numAngles; i++)
+  {
+    seedVal = seedVal * 1664525u + 1013904223u;
+    outAngles[i] = limitVal * (2.0 * (seedVal / 4294967296.0) - 1.0);
+  }
+}
+
+//This function returns the distance between "firstVal" and "secondVal" in
+//units in the last place, i.e. how many doubles lie between them.
+static double ulpDistance(const double firstVal, const double secondVal)
+{
+  const unsigned long long signBit = 1ULL << 63;
+  unsigned long long firstKey;
+  unsigned long long secondKey;
+
+  memcpy(&firstKey, &firstVal, sizeof(firstKey));
+  memcpy(&secondKey, &secondVal, sizeof(secondKey));
+  // map sign-magnitude bits onto a line that is monotonic in the value
+  firstKey = (firstKey & signBit) ? ~firstKey : (firstKey | signBit);
+  secondKey = (secondKey & signBit) ? ~secondKey : (secondKey | signBit);
+
+  return (double)(firstKey > secondKey ? firstKey - secondKey
+                                       : secondKey - firstKey);
+}
+
+//This function prints the CSV header line.
+static void printBenchHeader()
+{
+  cout << "function,numTerms,band,numCalls,nsPerCall,callsPerSec,"
+       << "maxAbsErr,meanAbsErr,maxUlpErr" << '\n';
+}
+
+//This function prints one CSV row. When "hasError" is false the error
+//columns are left empty.
+static void printBenchRow(const char* funcName, const int numTerms,
+                          const char* bandName, const double numCalls,
+                          const double elapsedSec, const bool hasError,
+                          const double maxAbsErr, const double meanAbsErr,
+                          const double maxUlpErr)
+{
+  cout << funcName << ',' << numTerms << ',' << bandName << ','
+       << numCalls << ',' << elapsedSec * NANOSEC_PER_SEC / numCalls << ','
+       << numCalls / elapsedSec << ',';
+  if (hasError)
+  {
+    cout << maxAbsErr << ',' << meanAbsErr << ',' << maxUlpErr;
+  }
+  else
+  {
+    cout << ",,";
+  }
+  cout << '\n';
+}
+
+//This function times "approximateSine" over "angles" and checks every
+//result against "refVals".
+static void benchApproximateSine(const double angles[], const double refVals[],
+                                 const int numTerms, const char* bandName)
+{
+  clock_t startTick;
+  double elapsedSec;
+  double numCalls;
+  double sineVal;
+  double sumVal;
+  double errVal;
+  double maxAbsErr;
+  double sumAbsErr;
+  double maxUlpErr;
+
+  // accuracy pass
+  maxAbsErr = 0.0;
+  sumAbsErr = 0.0;
+  maxUlpErr = 0.0;
+  for (int i = 0; i < BENCH_NUM_ANGLES; i++)
+  {
+    approximateSine(angles[i], numTerms, sineVal);
+    errVal = fabs(sineVal - refVals[i]);
+    sumAbsErr += errVal;
+    maxAbsErr = errVal > maxAbsErr ? errVal : maxAbsErr;
+    errVal = ulpDistance(sineVal, refVals[i]);
+    maxUlpErr = errVal > maxUlpErr ? errVal : maxUlpErr;
+  }
+
+  // speed pass
+  numCalls = 0.0;
+  sumVal = 0.0;
+  startTick = clock();
+  do
+  {
+    for (int i = 0; i < BENCH_NUM_ANGLES; i++)
+    {
+      approximateSine(angles[i], numTerms, sineVal);
+      sumVal += sineVal;
+    }
+    numCalls += BENCH_NUM_ANGLES;
+    elapsedSec = (double)(clock() - startTick) / CLOCKS_PER_SEC;
+  } while (elapsedSec < BENCH_MIN_SECONDS);
+  benchSinkVal = sumVal;
+
+  printBenchRow("approximateSine", numTerms, bandName, numCalls, elapsedSec,
+                true, maxAbsErr, sumAbsErr / BENCH_NUM_ANGLES, maxUlpErr);
+}
+
+//This function times "toThePower" raising each of "angles" to the odd
+//power used by term "numTerms" of the series, checked against std::pow.
+static void benchToThePower(const double angles[], const int numTerms,
+                            const char* bandName)
+{
+  clock_t startTick;
+  double elapsedSec;
+  double numCalls;
+  double powVal;
+  double refVal;
+  double sumVal;
+  double errVal;
+  double maxAbsErr;
+  double sumAbsErr;
+  double maxUlpErr;
+  int exponentVal;
+
+  exponentVal = 2 * numTerms - 1;
+
+  maxAbsErr = 0.0;
+  sumAbsErr = 0.0;
+  maxUlpErr = 0.0;
+  for (int i = 0; i < BENCH_NUM_ANGLES; i++)
+  {
+    toThePower(angles[i], exponentVal, powVal);
+    refVal = pow(angles[i], exponentVal);
+    errVal = fabs(powVal - refVal);
+    sumAbsErr += errVal;
+    maxAbsErr = errVal > maxAbsErr ? errVal : maxAbsErr;
+    errVal = ulpDistance(powVal, refVal);
+    maxUlpErr = errVal > maxUlpErr ? errVal : maxUlpErr;
+  }
+
+  numCalls = 0.0;
+  sumVal = 0.0;
+  startTick = clock();
+  do
+  {
+    for (int i = 0; i < BENCH_NUM_ANGLES; i++)
+    {
+      toThePower(angles[i], exponentVal, powVal);
+      sumVal += powVal;
+    }
+    numCalls += BENCH_NUM_ANGLES;
+    elapsedSec = (double)(clock() - startTick) / CLOCKS_PER_SEC;
+  } while (elapsedSec < BENCH_MIN_SECONDS);
+  benchSinkVal = sumVal;
+
+  printBenchRow("toThePower", numTerms, bandName, numCalls, elapsedSec,
+                true, maxAbsErr, sumAbsErr / BENCH_NUM_ANGLES, maxUlpErr);
+}
+
+//This function times "computeFactorial" of the odd value used by term
+//"numTerms" of the series. The result is exact, so no error is reported.
+static void benchComputeFactorial(const int numTerms)
+{
+  volatile int inVal; // re-read every call so the loop is not folded
+  clock_t startTick;
+  double elapsedSec;
+  double numCalls;
+  int factorialVal;
+  int sumVal;
+
+  inVal = 2 * numTerms - 1;
+  factorialVal = 0;
+
+  numCalls = 0.0;
+  sumVal = 0;
+  startTick = clock();
+  do
+  {
+    for (int i = 0; i < BENCH_NUM_ANGLES; i++)
+    {
+      computeFactorial(inVal, factorialVal);
+      sumVal += factorialVal;
+    }
+    numCalls += BENCH_NUM_ANGLES;
+    elapsedSec = (double)(clock() - startTick) / CLOCKS_PER_SEC;
+  } while (elapsedSec < BENCH_MIN_SECONDS);
+  benchSinkVal = sumVal;
+
+  printBenchRow("computeFactorial", numTerms, "-", numCalls, elapsedSec,
+                false, 0.0, 0.0, 0.0);
+}
+
+//This function checks "approximateSineToTolerance" on CHECK_ANGLES and on
+//±infinity and NaN against std::sin, printing one line per angle to
+//stderr. Return true if every finite angle is within CHECK_MAX_ABS_ERR
+//and every non-finite one gives NaN, as std::sin does.
+static bool checkLargeAngles()
+{
+  const double specialAngles[3] =
+  {
+    numeric_limits<double>::infinity(),
+    -numeric_limits<double>::infinity(),
+    numeric_limits<double>::quiet_NaN()
+  };
+  double sineVal;
+  double refVal;
+  double errVal;
+  bool isPass;
+  bool isAllPass;
+  int numTerms;
+
+  isAllPass = true;
+  for (int i = 0; i < CHECK_NUM_ANGLES; i++)
+  {
+    approximateSineToTolerance(CHECK_ANGLES[i], CHECK_TOLERANCE, sineVal,
+                               numTerms);
+    refVal = sin(CHECK_ANGLES[i]);
+    errVal = fabs(sineVal - refVal);
+    isPass = errVal <= CHECK_MAX_ABS_ERR;
+    isAllPass = isAllPass && isPass;
+    cerr << "check," << CHECK_ANGLES[i] << ',' << sineVal << ',' << refVal
+         << ',' << errVal << ',' << (isPass ? "ok" : "FAIL") << '\n';
+  }
+  for (int i = 0; i < 3; i++)
+  {
+    approximateSineToTolerance(specialAngles[i], CHECK_TOLERANCE, sineVal,
+                               numTerms);
+    refVal = sin(specialAngles[i]);
+    // only NaN compares unequal to itself
+    isPass = sineVal != sineVal;
+    isAllPass = isAllPass && isPass;
+    cerr << "check," << specialAngles[i] << ',' << sineVal << ',' << refVal
+         << ",," << (isPass ? "ok" : "FAIL") << '\n';
+  }
+
+  return isAllPass;
+}
+
+int main()
+{
+  static double angles[BENCH_NUM_ANGLES];
+  static double refVals[BENCH_NUM_ANGLES];
+  bool isCheckOk;
+
+  printBenchHeader();
+  for (int band = 0; band < BENCH_NUM_BANDS; band++)
+  {
+    makeBenchAngles(BENCH_BAND_LIMIT[band], BENCH_NUM_ANGLES, angles);
+    // reference run
+    for (int i = 0; i < BENCH_NUM_ANGLES; i++)
+    {
+      refVals[i] = sin(angles[i]);
+    }
+
+    for (int numTerms = MIN_NUM_TERM; numTerms <= MAX_NUM_TERM; numTerms++)
+    {
+      benchApproximateSine(angles, refVals, numTerms, BENCH_BAND_NAME[band]);
+    }
+    for (int numTerms = MIN_NUM_TERM; numTerms <= MAX_NUM_TERM; numTerms++)
+    {
+      benchToThePower(angles, numTerms, BENCH_BAND_NAME[band]);
+    }
+  }
+  for (int numTerms = MIN_NUM_TERM; numTerms <= MAX_NUM_TERM; numTerms++)
+  {
+    benchComputeFactorial(numTerms);
+  }
+  cout.flush();
+  cerr << "check,angle,result,std::sin,absErr,status" << '\n';
+  isCheckOk = checkLargeAngles();
+
+  return isCheckOk ? 0 : 1;
+}
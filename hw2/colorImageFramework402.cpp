@@ -1,4 +1,26 @@
 #include <iostream>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <stdexcept>
+#include <stdint.h>
+#if defined(__GNUC__) && defined(__x86_64__)
+#include <immintrin.h>
+#define IMAGE_X86_SIMD
+#endif
+#if defined(__GNUC__) && defined(__unix__)
+#include <pthread.h>
+#include <unistd.h>
+#define IMAGE_THREADS
+#endif
+#if defined(__unix__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#define IMAGE_MMAP
+#endif
 using namespace std;
 
 // Author: Kaiyang Luo, Date: Sep 25
@@ -11,6 +33,58 @@ const int MAX_COLOR_VALUE = 1000;
 const int IDX_DEFAULT = -99999;
 const int IMAGE_ROW_NUM = 10;
 const int IMAGE_COL_NUM = 18;
+// Pixel buffers and every row in them start on a cache line
+const int PIXEL_ALIGN_BYTES = 64;
+// Each pixel allocation starts with one cache line holding the count of
+// images sharing it; the planes follow
+const int PIXEL_HEADER_BYTES = PIXEL_ALIGN_BYTES;
+// Images keep each channel in its own plane of 16-bit values
+const int NUM_COLOR_CHANNELS = 3;
+const int CHANNEL_RED = 0;
+const int CHANNEL_GREEN = 1;
+const int CHANNEL_BLUE = 2;
+// When "addImages" clips: after every image is added (like adding them one
+// at a time with "addImageTo"), or once to the final sum
+const int CLIP_EACH_ADD = 0;
+const int CLIP_AT_END = 1;
+// Values per plane row that "addImages" and image expressions work on at a
+// time; the input segments and partial results of one tile stay in L1
+const int ADD_TILE_COLS = 512;
+// Steps of an image expression ("ImageExprClass")
+const int EXPR_IMAGE = 0;
+const int EXPR_ADD = 1;
+const int EXPR_SUBTRACT = 2;
+const int EXPR_SCALE = 3;
+// Most images and operations one expression can hold
+const int MAX_EXPR_NODES = 16;
+// Whole-image operations run in bands of rows on the image thread pool.
+// A band covers about this many bytes of all three planes (an L2 share).
+const int BAND_TARGET_BYTES = 256 * 1024;
+// Images with fewer pixels than this are done on the calling thread
+const int PARALLEL_MIN_PIXELS = 1 << 16;
+const int MAX_IMAGE_THREADS = 64;
+// Free buffers a "PixelPoolClass" keeps for reuse
+const int POOL_MAX_FREE_BUFFERS = 8;
+// Batched pixel writes of at least this many points (and one per row or
+// more) are bucketed by row before they are applied
+const int BATCH_BUCKET_MIN_POINTS = 1024;
+// Images made by the value ctor or "initializeTo" are kept solid: one
+// color plus a list of the pixels set to another. They get dense planes
+// once they hold more than one edit per SOLID_PIXELS_PER_EDIT pixels, or
+// more than SOLID_MAX_EDITS, as the planes are then the cheaper form.
+const int SOLID_PIXELS_PER_EDIT = 16;
+const int SOLID_MAX_EDITS = 4096;
+// Images record when each tile of this many rows by columns last changed,
+// so "ImageCompositorClass" only adds up again the tiles that did
+const int DIRTY_TILE_ROWS = 16;
+const int DIRTY_TILE_COLS = 256;
+// Binary PPM (P6) and PGM (P5) files. Samples above 255 take two bytes,
+// so the default maxval of MAX_COLOR_VALUE keeps colors exact.
+const int PPM_MAX_VAL = 65535;
+// A header (with comments) must fit in this many bytes
+const int PPM_MAX_HEADER_BYTES = 4096;
+// Bytes "writePpm" and "printImage" format before each write
+const int IMAGE_IO_BUFFER_BYTES = 256 * 1024;
 
 
 // CLASS DEFINITION
@@ -74,6 +148,11 @@ class ColorClass
          const double adjFactor
          );
 
+    // These getter functions simply return the appropriate value
+    int getRed() const;
+    int getGreen() const;
+    int getBlue() const;
+
     // Print color values using the format "R: <red> G: <green> B: <blue>"
     void printComponentValues() const;
 
@@ -124,36 +203,524 @@ class RowColumnClass
     void printRowCol() const;
 };
 
+// Where image pixel buffers come from. Derive from it and pass an object
+// to "ColorImageClass::setPixelAllocator" to plug in another allocator.
+class PixelAllocatorClass
+{
+  public:
+    virtual ~PixelAllocatorClass();
+
+    // Return a buffer of "numBytes" bytes starting on a PIXEL_ALIGN_BYTES
+    // boundary, or 0 if there is no memory
+    virtual void* allocateBuffer(
+         const size_t numBytes
+         ) = 0;
+    // Give back a buffer "allocateBuffer" returned for "numBytes" bytes
+    virtual void releaseBuffer(
+         void *bufferPtr,
+         const size_t numBytes
+         ) = 0;
+};
+
+// Default allocator. Released buffers are kept (up to
+// POOL_MAX_FREE_BUFFERS of them) and handed out again for the next request
+// of the same size, so frames of one size stop hitting the heap.
+class PixelPoolClass : public PixelAllocatorClass
+{
+  private:
+    // Member Attributes
+    void *freeBuffers[POOL_MAX_FREE_BUFFERS];
+    size_t freeSizes[POOL_MAX_FREE_BUFFERS];
+    int numFree;
+
+    // Private member function
+    // Aligned heap allocation; the malloc'd pointer is kept just before
+    // the returned one
+    static void* allocateAligned(
+         const size_t numBytes
+         );
+    static void releaseAligned(
+         void *bufferPtr
+         );
+
+    // Not copyable, it owns its free buffers
+    PixelPoolClass(
+         const PixelPoolClass &rhsPool
+         );
+    PixelPoolClass& operator=(
+         const PixelPoolClass &rhsPool
+         );
+
+  public:
+    // Ctor
+    // Start with an empty pool
+    PixelPoolClass();
+    // Dtor frees every buffer still in the pool
+    ~PixelPoolClass();
+
+    void* allocateBuffer(
+         const size_t numBytes
+         );
+    void releaseBuffer(
+         void *bufferPtr,
+         const size_t numBytes
+         );
+};
+
+class ColorImageClass;
+class ImageExprClass;
+
+// One whole-image operation, split into bands of rows that may run on
+// different threads at once
+class BandTaskClass
+{
+  public:
+    virtual ~BandTaskClass();
+
+    // Do rows "firstRow" up to (not including) "endRow". Return true if
+    // any value was clipped.
+    virtual bool runRows(
+         const int firstRow,
+         const int endRow
+         ) = 0;
+};
+
+// Arguments of "ColorImageClass::addImages", as one value
+struct AddImagesArgType
+{
+  int numImgsToAdd;
+  const ColorImageClass *imagesToAdd;
+  int clipMode;
+};
+
+// Arguments of an "ImageCompositorClass" update, as one value
+struct CompositeArgType
+{
+  AddImagesArgType addArgs;
+  uint64_t lastStamp; // tiles an input changed after this are redone
+  bool *tileClips; // clip flag of each tile of the sum
+};
+
+// What the header of a PPM or PGM file says
+struct PpmHeaderType
+{
+  int numChannels; // 3 for P6, 1 for P5
+  int colNum;
+  int rowNum;
+  int maxVal;
+  int bytesPerVal;
+  size_t dataOffset; // where the samples start
+};
+
+// Sample bytes of PPM rows to bring into an image, and the table taking
+// each sample value to a color value
+struct PpmRowsArgType
+{
+  const unsigned char *dataPtr;
+  size_t rowBytes;
+  int numChannels;
+  int bytesPerVal;
+  const uint16_t *valTable;
+};
+
+// Start of every pixel allocation, in the cache line before the planes
+struct PixelHeaderType
+{
+  int shareCount; // images sharing the buffer
+  bool hasViews; // once set, copies get pixels of their own
+};
+
+// When the parts of an image last changed, as stamps from
+// "nextDirtyStamp"; a later stamp is a later change
+struct DirtyTilesType
+{
+  uint64_t wholeStamp; // last change to the whole image
+  uint64_t *tileStamps; // per tile, row by row; 0 until one tile changes
+  int numTileRows;
+  int numTileCols;
+};
+
+// A pixel of a solid image that is not the solid color
+struct SolidEditType
+{
+  size_t pixelIdx; // rowIdx * colNum + colIdx, which can pass INT_MAX
+  uint16_t colorVals[NUM_COLOR_CHANNELS];
+};
+
 class ColorImageClass
 {
   private:
     // Member Attributes
     int rowNum;
     int colNum;
-    ColorClass pixelArrary[IMAGE_ROW_NUM][IMAGE_COL_NUM];
+    // One allocation holding a red, a green and a blue plane of uint16_t
+    // values (colors never leave [0, 1000]), each rowNum rows of rowStride
+    // values. The stride is padded so every row starts on a cache line;
+    // padding stays 0. Pixels are read and written as ColorClass values.
+    // Copies share the buffer until one of them writes to it; 0 once the
+    // pixels have been moved to another image. A view points at its first
+    // pixel inside the buffer of its parent.
+    int rowStride;
+    // Values from the start of one plane to the next
+    size_t planeStep;
+    uint16_t *pixelBuffer;
+    PixelHeaderType *pixelHeader;
+    // True for an "ImageViewClass"; the buffer then belongs to the parent
+    bool isView;
+    // The allocator "pixelBuffer" came from, so it goes back to the same one
+    PixelAllocatorClass *allocatorPtr;
+    // A solid image has no planes ("pixelBuffer" is 0): every pixel is
+    // "solidVals" except the "numSolidEdits" pixels in "solidEdits", kept
+    // in pixel order
+    bool isSolid;
+    uint16_t solidVals[NUM_COLOR_CHANNELS];
+    SolidEditType *solidEdits;
+    int numSolidEdits;
+    int solidEditCapacity;
+    // When each tile last changed. A view marks the tiles of the image it
+    // is in, through "dirtyTiles", at "dirtyOriginRow", "dirtyOriginCol".
+    DirtyTilesType ownDirty;
+    DirtyTilesType *dirtyTiles;
+    int dirtyOriginRow;
+    int dirtyOriginCol;
+
+    // Allocator used by images created from now on
+    static PixelAllocatorClass *currentAllocator;
+
+    // Private member function
+    // Allocate the planes for "inRowNum" x "inColNum" pixels, all black
+    // unless "isCleared" is false
+    void allocatePixels(
+         const int inRowNum,
+         const int inColNum,
+         const bool isCleared = true
+         );
+    // Drop this image's share of the buffer, returning it to its
+    // allocator if no other image shares it
+    void releasePixels();
+    // Share the buffer of "rhsImg"
+    void sharePixels(
+         const ColorImageClass &rhsImg
+         );
+    // Give the image a copy of its pixels of its own if the buffer is
+    // shared, or planes if it is solid; called before every write
+    void unsharePixels();
+    // Make the image an unshared "inRowNum" x "inColNum" buffer whose
+    // pixels are all about to be written. A view keeps its pixels.
+    void preparePixels(
+         const int inRowNum,
+         const int inColNum
+         );
+    // Copy "rhsImg" into the image where they overlap
+    void copyPixels(
+         const ColorImageClass &rhsImg
+         );
+    // Whether "rhsImg" is another part of the same buffer, so writing the
+    // image row by row could change pixels of "rhsImg" not yet read
+    bool overlapsShifted(
+         const ColorImageClass &rhsImg
+         ) const;
+    // Whether the image may drop its planes for the solid form; a view,
+    // or an image with views, keeps them
+    bool canBeSolid() const;
+    // Make the image a solid "inRowNum" x "inColNum" image of "inVals"
+    void makeSolid(
+         const int inRowNum,
+         const int inColNum,
+         const uint16_t inVals[]
+         );
+    // Most edits the image holds before dense planes are cheaper
+    int maxSolidEdits() const;
+    // Pixel index of location ("rowIdx", "colIdx") in the solid form
+    size_t solidPixelIdx(
+         const int rowIdx,
+         const int colIdx
+         ) const;
+    // Index of the first edit at or after pixel "pixelIdx"
+    int findSolidEdit(
+         const size_t pixelIdx
+         ) const;
+    // Make room for "numEdits" edits
+    void reserveSolidEdits(
+         const int numEdits
+         );
+    // Set pixel "pixelIdx" of a solid image to "inVals". Return false,
+    // changing nothing, if that takes more than "maxSolidEdits" edits.
+    bool setSolidEdit(
+         const size_t pixelIdx,
+         const uint16_t inVals[]
+         );
+    // Color values of pixel "pixelIdx" of a solid image
+    const uint16_t* solidPixel(
+         const size_t pixelIdx
+         ) const;
+    // Give a solid image planes holding the same pixels
+    void densifyPixels();
+    // Whether "rhsImg" can be added to or subtracted from the image in
+    // the solid form: both solid, "rhsImg" covering the image, and few
+    // enough edits between them
+    bool canCombineSolid(
+         const ColorImageClass &rhsImg
+         ) const;
+    // Add "rhsImg" ("opType" EXPR_ADD) or subtract it (EXPR_SUBTRACT),
+    // working out only the solid color and the edited pixels. Return true
+    // if require clipping.
+    bool combineSolid(
+         const ColorImageClass &rhsImg,
+         const int opType
+         );
+    // The "numVals" values of channel "channelIdx", row "rowIdx" from
+    // column "firstCol": straight from the plane, or written into
+    // "scratchVals" if the image is solid
+    const uint16_t* rowVals(
+         const int channelIdx,
+         const int rowIdx,
+         const int firstCol,
+         const int numVals,
+         uint16_t scratchVals[]
+         ) const;
+    // Whether "addImages" of these inputs can work in the solid form
+    bool canSumSolid(
+         const int numImgsToAdd,
+         const ColorImageClass imagesToAdd[]
+         ) const;
+    // Start with no change recorded, in tiles of the image's own
+    void initDirtyTiles();
+    // Record that the whole image changed, and may have a new size
+    void markDirty();
+    // Record, with "dirtyStamp", that rows "firstRow" up to "endRow",
+    // columns "firstCol" up to "endCol" changed
+    void markDirtyRegion(
+         const uint64_t dirtyStamp,
+         const int firstRow,
+         const int endRow,
+         const int firstCol,
+         const int endCol
+         );
+    // Stamp of the last change to that region (the part inside the
+    // image), or to the whole image
+    uint64_t regionStamp(
+         const int firstRow,
+         const int endRow,
+         const int firstCol,
+         const int endCol
+         ) const;
+    // Bytes held by the planes
+    size_t bufferBytes() const;
+    // Values in one plane
+    size_t planeSize() const;
+    // Start of row "rowIdx" in the plane of channel "channelIdx"
+    uint16_t* planeRow(
+         const int channelIdx,
+         const int rowIdx
+         );
+    const uint16_t* planeRow(
+         const int channelIdx,
+         const int rowIdx
+         ) const;
+
+    // Band bodies of the whole-image operations, for rows "firstRow" up
+    // to "endRow". Each returns true if any value was clipped.
+    bool clearRows(
+         const int &unusedArg,
+         const int firstRow,
+         const int endRow
+         );
+    bool copyRows(
+         const ColorImageClass &rhsImg,
+         const int firstRow,
+         const int endRow
+         );
+    bool fillRows(
+         const ColorClass &inColor,
+         const int firstRow,
+         const int endRow
+         );
+    bool addRows(
+         const ColorImageClass &rhsImg,
+         const int firstRow,
+         const int endRow
+         );
+    bool subtractRows(
+         const ColorImageClass &rhsImg,
+         const int firstRow,
+         const int endRow
+         );
+    bool scaleRows(
+         const double &adjFactor,
+         const int firstRow,
+         const int endRow
+         );
+    bool sumRows(
+         const AddImagesArgType &addArgs,
+         const int firstRow,
+         const int endRow
+         );
+    // Rows here are rows of tiles
+    bool compositeRows(
+         const CompositeArgType &compArgs,
+         const int firstRow,
+         const int endRow
+         );
+    bool exprRows(
+         const ImageExprClass &inExpr,
+         const int firstRow,
+         const int endRow
+         );
+    bool ppmRows(
+         const PpmRowsArgType &ppmArgs,
+         const int firstRow,
+         const int endRow
+         );
+    // "sumRows" for columns "firstCol" up to "endCol" only
+    bool sumRegion(
+         const AddImagesArgType &addArgs,
+         const int firstRow,
+         const int endRow,
+         const int firstCol,
+         const int endCol
+         );
+
+    // Fill "outValidBits" for the "numPoints" locations in "inRowCols"
+    // and return how many are valid
+    int checkLocations(
+         const int numPoints,
+         const RowColumnClass inRowCols[],
+         uint32_t outValidBits[]
+         ) const;
+
+    // Bring the first "numRows" rows of PPM samples in "ppmArgs" into
+    // the image
+    void importPpmRows(
+         const PpmRowsArgType &ppmArgs,
+         const int numRows
+         );
+
+    friend class PpmStripReaderClass;
+    friend class ImageCompositorClass;
+
+  protected:
+    // For "ImageViewClass"
+    // View ctor: the "inRowNum" x "inColNum" rectangle of "parentImg" at
+    // "originRowCol", cut to fit inside it
+    ColorImageClass(
+         const ColorImageClass &parentImg,
+         const RowColumnClass &originRowCol,
+         const int inRowNum,
+         const int inColNum
+         );
+    // Give "parentImg" a buffer no copy shares, now or later, so writes
+    // through its views only ever reach its own pixels; return it
+    static ColorImageClass& prepareForViews(
+         ColorImageClass &parentImg
+         );
 
   public:
     // Member Functions
     
     // Ctor
-    // Default ctor set all pixels to full black
+    // Default ctor set all pixels to full black, at IMAGE_ROW_NUM rows by
+    // IMAGE_COL_NUM columns
     ColorImageClass();
+    // Value ctor makes an all black image of "inRowNum" rows by "inColNum"
+    // columns. Sizes below 1 are raised to 1.
+    ColorImageClass(
+         const int inRowNum,
+         const int inColNum
+         );
+    // Copy ctor and assignment share the buffer of "rhsImg"; the pixels
+    // are only copied when one of the images is written. Copies of a view,
+    // or of an image that has views, get their own pixels straight away.
+    // Assigning to a view copies "rhsImg" into it where they overlap.
+    ColorImageClass(
+         const ColorImageClass &rhsImg
+         );
+    ColorImageClass& operator=(
+         const ColorImageClass &rhsImg
+         );
+#if __cplusplus >= 201103L
+    // Move ctor and assignment take the buffer of "rhsImg" and leave it
+    // empty (0 x 0) until it is assigned again. Views are copied instead.
+    ColorImageClass(
+         ColorImageClass &&rhsImg
+         );
+    ColorImageClass& operator=(
+         ColorImageClass &&rhsImg
+         );
+#endif
+    // Dtor gives the buffer back to its allocator once no image shares it
+    ~ColorImageClass();
+
+    // Exchange size and pixels with "rhsImg" without copying any
+    void swap(
+         ColorImageClass &rhsImg
+         );
+
+    // Use "inAllocator" for the buffers of images created from now on; 0
+    // goes back to the built-in pool. Existing images keep theirs.
+    static void setPixelAllocator(
+         PixelAllocatorClass *inAllocator
+         );
+
+    // Run whole-image operations on "numThreads" threads (counting the
+    // caller); 0 means one per online core and 1 runs everything serially.
+    // Small images are always done serially.
+    static void setThreadCount(
+         const int numThreads
+         );
+
+    // These getter functions simply return the appropriate value
+    int getRowNum() const;
+    int getColNum() const;
     
-    // Initial all pixels to the color provided 
+    // Initial all pixels to the color provided. The image is then kept
+    // solid (see SOLID_PIXELS_PER_EDIT) unless it is or has a view.
     void initializeTo(
          const ColorClass &inColor
          );
 
-    // Add image to object. Return true if require clipping
+    // Add image to object. Return true if require clipping. Images of
+    // different sizes are added where they overlap (from the top left).
     bool addImageTo(
          const ColorImageClass &rhsImg
          );
 
+    // Subtract image from object, the way "ColorClass::subtractColor" does
+    // per pixel. Return true if require clipping. Images of different
+    // sizes are subtracted where they overlap.
+    bool subtractImage(
+         const ColorImageClass &rhsImg
+         );
+
+    // Adjust the brightness of every pixel, the way
+    // "ColorClass::adjustBrightness" does. Return true if require clipping.
+    bool adjustBrightness(
+         const double adjFactor
+         );
+
     // Add images and assign object to the result.
-    // Return true if require clipping.
+    // Return true if require clipping. The result keeps the size of the
+    // object; each input is added where it overlaps. Each output value is
+    // visited once: all inputs are summed tile by tile in 32-bit values and
+    // written straight into the object, which may itself be one of the
+    // inputs. "clipMode" is CLIP_EACH_ADD or CLIP_AT_END; colors are never
+    // negative, so both give the same pixels and clip flag, and
+    // CLIP_AT_END skips the clamp inside the loop.
     bool addImages(
          const int numImgsToAdd,
-         const ColorImageClass imagesToAdd[]
+         const ColorImageClass imagesToAdd[],
+         const int clipMode = CLIP_EACH_ADD
+         );
+
+    // Assign object to the result of "inExpr", e.g. "(a + b - c) * 0.5".
+    // Return true if require clipping. The whole expression is worked out
+    // in one pass, tile by tile, but every step clips where it would if
+    // the operations were run one by one with "addImageTo",
+    // "subtractImage" and "adjustBrightness" on a copy of the first image,
+    // so pixels and clip flag are the same. The object takes the size of
+    // the first image and may itself appear in "inExpr".
+    bool assignExpr(
+         const ImageExprClass &inExpr
          );
 
     // Set pixels at the "inRowCol" location to the "inColor".
@@ -172,10 +739,263 @@ class ColorImageClass
          ColorClass &outColor
          ) const;
 
+    // Batched "setColorAtLocation": set the pixel at each of the
+    // "numPoints" locations in "inRowCols" to the matching color in
+    // "inColors". Bit (k % 32) of "outValidBits[k / 32]" is set if
+    // location k is valid, so it needs (numPoints + 31) / 32 words; invalid
+    // locations are skipped. Return true if every location is valid. Large
+    // batches are applied row by row, but a location given twice still
+    // ends up with the later color.
+    bool setColorsAtLocations(
+         const int numPoints,
+         const RowColumnClass inRowCols[],
+         const ColorClass inColors[],
+         uint32_t outValidBits[]
+         );
+
+    // Batched "getColorAtLocation": "outColors[k]" is assigned the color
+    // at location k if it is valid and left alone if not. The validity
+    // bits and return value are as for "setColorsAtLocations".
+    bool getColorsAtLocations(
+         const int numPoints,
+         const RowColumnClass inRowCols[],
+         ColorClass outColors[],
+         uint32_t outValidBits[]
+         ) const;
+
     // Print the contents of the image.
     void printImage() const;
 
+    // Load a binary PPM (P6) or PGM (P5) file, of any size and maxval, and
+    // return true. Samples are scaled from [0, maxval] to the color range;
+    // gray files set all three channels. The file is mapped into memory
+    // and converted straight into the planes, in row bands on the thread
+    // pool. If the file cannot be read or is not a valid PPM/PGM, return
+    // false and leave the image unchanged.
+    bool readPpm(
+         const char *fileName
+         );
+
+    // Save the image as a binary PPM (P6) file with maxval "outMaxVal"
+    // (1 to PPM_MAX_VAL) and return true if it was all written. The default
+    // keeps colors exact; 255 gives the 8-bit files most viewers expect.
+    bool writePpm(
+         const char *fileName,
+         const int outMaxVal = MAX_COLOR_VALUE
+         ) const;
+
+};
+
+// Reads a PPM or PGM file a strip of rows at a time, so files larger
+// than memory can be processed. Only one strip is held at once.
+class PpmStripReaderClass
+{
+  private:
+    // Member Attributes
+    FILE *filePtr;
+    PpmHeaderType ppmHeader;
+    int nextRow;
+    unsigned char *stripBytes;
+    size_t stripCapacity;
+    uint16_t *valTable;
+
+    // Not copyable, it owns the file
+    PpmStripReaderClass(
+         const PpmStripReaderClass &rhsReader
+         );
+    PpmStripReaderClass& operator=(
+         const PpmStripReaderClass &rhsReader
+         );
+
+  public:
+    // Ctor
+    // Start with no file open
+    PpmStripReaderClass();
+    // Dtor closes the file
+    ~PpmStripReaderClass();
+
+    // Open "fileName" and read its header. Return false if it cannot be
+    // opened or is not a valid PPM/PGM file.
+    bool openFile(
+         const char *fileName
+         );
+    void closeFile();
+
+    // Size of the whole image in the file, 0 if none is open
+    int getRowNum() const;
+    int getColNum() const;
+
+    // Read the next (up to) "maxRows" rows into "outStrip", which takes
+    // their size. Return false once every row has been read, or on a read
+    // error.
+    bool readStrip(
+         const int maxRows,
+         ColorImageClass &outStrip
+         );
+};
+
+// A rectangle of another image, worked on in place. It is a
+// "ColorImageClass", so every image operation takes it, as the object or
+// as an argument, and touches only the pixels of the rectangle in the
+// parent's buffer; nothing is copied. Locations are relative to its
+// origin. Copying a view gives another view of the same pixels, and
+// assigning to one copies pixels into the rectangle. The parent must
+// outlive its views and keep its buffer (not be assigned, resized or
+// moved from) while they are used. The one exception is assigning a view
+// to its own parent, "img = ImageViewClass(img, ...)", which crops the
+// parent to the rectangle; other views of it are then left dangling. Once
+// an image has had a view, its copies no longer share its buffer.
+class ImageViewClass : public ColorImageClass
+{
+  public:
+    // Ctor
+    // View of the "inRowNum" x "inColNum" rectangle of "parentImg" whose
+    // top left is "originRowCol". The rectangle is cut to fit inside the
+    // parent; a view with nothing left in it is 0 x 0.
+    ImageViewClass(
+         ColorImageClass &parentImg,
+         const RowColumnClass &originRowCol,
+         const int inRowNum,
+         const int inColNum
+         );
+    // Copy ctor views the same pixels as "rhsView"
+    ImageViewClass(
+         const ImageViewClass &rhsView
+         );
+
+    // Copy "rhsImg" into the viewed pixels where they overlap
+    ImageViewClass& operator=(
+         const ColorImageClass &rhsImg
+         );
+    ImageViewClass& operator=(
+         const ImageViewClass &rhsView
+         );
+};
+
+// Keeps the sum of "numImgsToAdd" images, as "addImages" works it out,
+// up to date. Every image records when each tile of DIRTY_TILE_ROWS x
+// DIRTY_TILE_COLS pixels last changed, so "composite" only adds up again
+// the tiles where some input changed since the last call: mostly static
+// inputs cost O(changed tiles) instead of O(pixels). It keeps a pointer
+// to the array of images, so they must outlive it.
+class ImageCompositorClass
+{
+  private:
+    // Member Attributes
+    AddImagesArgType addArgs;
+    ColorImageClass sumImg;
+    // Stamp taken by the last "composite"; 0 while every tile has to be
+    // worked out
+    uint64_t compositeStamp;
+    // Clip flag of each tile of the sum, row by row
+    bool *tileClips;
+    int numTiles;
+
+    // Not copyable, it owns the tile flags
+    ImageCompositorClass(
+         const ImageCompositorClass &rhsCompositor
+         );
+    ImageCompositorClass& operator=(
+         const ImageCompositorClass &rhsCompositor
+         );
+
+  public:
+    // Ctor
+    // Sum of "imagesToAdd" into an "inRowNum" x "inColNum" image, each
+    // input added where it overlaps, clipping as "clipMode" says. Nothing
+    // is worked out until "composite".
+    ImageCompositorClass(
+         const int numImgsToAdd,
+         const ColorImageClass imagesToAdd[],
+         const int inRowNum,
+         const int inColNum,
+         const int clipMode = CLIP_EACH_ADD
+         );
+    // Dtor
+    ~ImageCompositorClass();
+
+    // Bring the sum up to date with the inputs. Return true if require
+    // clipping, as "addImages" would.
+    bool composite();
+
+    // The sum as of the last "composite"
+    const ColorImageClass& getSum() const;
+};
+
+// An image expression of add, subtract and scale steps over images. It
+// only records the steps (in postfix order); nothing is computed until
+// "ColorImageClass::assignExpr". It keeps pointers to its images, so they
+// must outlive it.
+class ImageExprClass
+{
+  private:
+    // One step: an image to push, or an operation on the top of the stack
+    struct ExprNodeType
+    {
+      int opType;
+      const ColorImageClass *imgPtr;
+      double adjFactor;
+    };
+
+    // Member Attributes
+    ExprNodeType exprNodes[MAX_EXPR_NODES];
+    int numNodes;
+
+    // Private member function
+    // Append the steps of "inExpr"; throw length_error past MAX_EXPR_NODES
+    void appendNodes(
+         const ImageExprClass &inExpr
+         );
+    void appendNode(
+         const int opType,
+         const double adjFactor
+         );
+
+    friend class ColorImageClass;
+    friend ImageExprClass operator+(
+         const ImageExprClass &lhsExpr,
+         const ImageExprClass &rhsExpr
+         );
+    friend ImageExprClass operator-(
+         const ImageExprClass &lhsExpr,
+         const ImageExprClass &rhsExpr
+         );
+    friend ImageExprClass operator*(
+         const ImageExprClass &lhsExpr,
+         const double adjFactor
+         );
+
+  public:
+    // Ctor
+    // An expression of just "inImg"; lets images be used in expressions
+    ImageExprClass(
+         const ColorImageClass &inImg
+         );
+
+    // Size of the result (that of the first image) and the largest row
+    // and column count of any image in the expression
+    void getExtents(
+         int &outRowNum,
+         int &outColNum,
+         int &outMaxRowNum,
+         int &outMaxColNum
+         ) const;
 };
+
+// Record "lhsExpr" plus, minus or scaled, the way "addImageTo",
+// "subtractImage" and "adjustBrightness" work
+ImageExprClass operator+(
+     const ImageExprClass &lhsExpr,
+     const ImageExprClass &rhsExpr
+     );
+ImageExprClass operator-(
+     const ImageExprClass &lhsExpr,
+     const ImageExprClass &rhsExpr
+     );
+ImageExprClass operator*(
+     const ImageExprClass &lhsExpr,
+     const double adjFactor
+     );
 // MAIN BODY
 #ifdef ANDREW_TEST
 #include "andrewTest.h"
@@ -554,88 +1374,3264 @@ bool ColorClass::adjustBrightness(
     return true;
 }   
 
+// These getter functions simply return the appropriate value
+int ColorClass::getRed() const
+{
+  return redVal;
+}
+
+int ColorClass::getGreen() const
+{
+  return greenVal;
+}
+
+int ColorClass::getBlue() const
+{
+  return blueVal;
+}
+
 // Print color values using the format "R: <red> G: <green> B: <blue>"
 void ColorClass::printComponentValues() const
 {
   cout << "R: " << redVal << " G: " << greenVal << " B: " << blueVal;
 }
 
-// ===== ColorImageClass Member Function =====
-   
+// ===== PixelPoolClass Member Function =====
+
+PixelAllocatorClass::~PixelAllocatorClass()
+{
+}
+
 // Ctor
-// Default ctor set all pixels to full black
-ColorImageClass::ColorImageClass()
+// Start with an empty pool
+PixelPoolClass::PixelPoolClass()
 {
-  rowNum = IMAGE_ROW_NUM;
-  colNum = IMAGE_COL_NUM;
-  for (int i = 0; i < rowNum; i++)
+  numFree = 0;
+}
+
+// Dtor frees every buffer still in the pool
+PixelPoolClass::~PixelPoolClass()
+{
+  for (int i = 0; i < numFree; i++)
   {
-    for (int j = 0; j < colNum; j++)
-    {
-      pixelArrary[i][j].setToBlack();
-    }
+    releaseAligned(freeBuffers[i]);
   }
 }
 
-// Initial all pixels to the color provided 
-void ColorImageClass::initializeTo(
-     const ColorClass &inColor
+// Aligned heap allocation; the malloc'd pointer is kept just before the
+// returned one
+void* PixelPoolClass::allocateAligned(
+     const size_t numBytes
      )
 {
-  for (int i = 0; i < rowNum; i++)
+  char *rawPtr = static_cast<char*>(
+       malloc(numBytes + PIXEL_ALIGN_BYTES + sizeof(void*)));
+  char *alignedPtr;
+
+  if (rawPtr == 0)
   {
-    for (int j = 0; j < colNum; j++)
-    {
-      pixelArrary[i][j].setTo(inColor);
-    }
+    return 0;
   }
-}    
+  alignedPtr = rawPtr + sizeof(void*);
+  alignedPtr += (PIXEL_ALIGN_BYTES -
+                 reinterpret_cast<size_t>(alignedPtr) % PIXEL_ALIGN_BYTES) %
+                PIXEL_ALIGN_BYTES;
+  reinterpret_cast<void**>(alignedPtr)[-1] = rawPtr;
 
-// Add image to object. Return true if require clipping
-bool ColorImageClass::addImageTo(
-     const ColorImageClass &rhsImg
+  return alignedPtr;
+}
+
+void PixelPoolClass::releaseAligned(
+     void *bufferPtr
      )
 {
-  bool flagClip = false;
+  if (bufferPtr != 0)
+  {
+    free(static_cast<void**>(bufferPtr)[-1]);
+  }
+}
 
-  for (int i = 0; i < rowNum; i++)
+// Reuse a free buffer of the same size if there is one
+void* PixelPoolClass::allocateBuffer(
+     const size_t numBytes
+     )
+{
+  void *bufferPtr;
+
+  for (int i = 0; i < numFree; i++)
   {
-    for (int j = 0; j < colNum; j++)
+    if (freeSizes[i] == numBytes)
     {
-      flagClip = pixelArrary[i][j].addColor(rhsImg.pixelArrary[i][j]) ||
-                 flagClip;
+      bufferPtr = freeBuffers[i];
+      numFree--;
+      freeBuffers[i] = freeBuffers[numFree];
+      freeSizes[i] = freeSizes[numFree];
+      return bufferPtr;
     }
   }
 
-  return flagClip;
-}     
+  return allocateAligned(numBytes);
+}
 
-// Add images and assign object to the result.
-// Return true if require clipping.
-bool ColorImageClass::addImages(
-     const int numImgsToAdd,
-     const ColorImageClass imagesToAdd[]
+// Keep the buffer for reuse; when the pool is full, the oldest free buffer
+// is dropped to make room
+void PixelPoolClass::releaseBuffer(
+     void *bufferPtr,
+     const size_t numBytes
      )
 {
-  ColorImageClass sumImg;
-  bool flagClip = false;
-
-  for (int i = 0; i < numImgsToAdd; i++)
+  if (bufferPtr == 0)
   {
-    flagClip = sumImg.addImageTo(imagesToAdd[i]) || flagClip;
+    return;
   }
-  
-  for (int i = 0; i < rowNum; i++)
+  if (numFree == POOL_MAX_FREE_BUFFERS)
+  {
+    releaseAligned(freeBuffers[0]);
+    numFree--;
+    for (int i = 0; i < numFree; i++)
+    {
+      freeBuffers[i] = freeBuffers[i + 1];
+      freeSizes[i] = freeSizes[i + 1];
+    }
+  }
+  freeBuffers[numFree] = bufferPtr;
+  freeSizes[numFree] = numBytes;
+  numFree++;
+}
+
+// ===== Image Row Kernel =====
+// Each kernel works on "numVals" values of one plane row, writes the
+// clipped result into "dstRow" and returns true if any value was clipped.
+// The vector forms clamp with min/max and OR the "clipped" lanes into one
+// mask that is tested once at the end, instead of branching per value.
+
+typedef bool (*AddRowKernelType)(uint16_t *dstRow, const uint16_t *srcRow,
+                                 const int numVals);
+typedef bool (*ScaleRowKernelType)(uint16_t *dstRow, const double adjFactor,
+                                   const int numVals);
+// Checks up to 32 locations against a "rowNum" x "colNum" image and
+// returns their validity bits, bit k for "inRowCols[k]"
+typedef uint32_t (*CheckPointsKernelType)(const RowColumnClass inRowCols[],
+                                          const int numPoints,
+                                          const int rowNum,
+                                          const int colNum);
+
+// The kernels picked for the running CPU
+struct RowKernelsType
+{
+  AddRowKernelType addRow;
+  AddRowKernelType subtractRow;
+  ScaleRowKernelType scaleRow;
+  CheckPointsKernelType checkPoints;
+};
+
+static bool addRowScalar(
+     uint16_t *dstRow,
+     const uint16_t *srcRow,
+     const int numVals
+     )
+{
+  bool flagClip = false;
+
+  for (int j = 0; j < numVals; j++)
+  {
+    int sumVal = dstRow[j] + srcRow[j];
+
+    if (sumVal > MAX_COLOR_VALUE)
+    {
+      sumVal = MAX_COLOR_VALUE;
+      flagClip = true;
+    }
+    dstRow[j] = static_cast<uint16_t>(sumVal);
+  }
+
+  return flagClip;
+}
+
+static bool subtractRowScalar(
+     uint16_t *dstRow,
+     const uint16_t *srcRow,
+     const int numVals
+     )
+{
+  bool flagClip = false;
+
+  for (int j = 0; j < numVals; j++)
+  {
+    int subVal = dstRow[j] - srcRow[j];
+
+    if (subVal < MIN_COLOR_VALUE)
+    {
+      subVal = MIN_COLOR_VALUE;
+      flagClip = true;
+    }
+    dstRow[j] = static_cast<uint16_t>(subVal);
+  }
+
+  return flagClip;
+}
+
+static bool scaleRowScalar(
+     uint16_t *dstRow,
+     const double adjFactor,
+     const int numVals
+     )
+{
+  bool flagClip = false;
+
+  for (int j = 0; j < numVals; j++)
+  {
+    int mulVal = static_cast<int>(dstRow[j] * adjFactor);
+
+    if (mulVal < MIN_COLOR_VALUE)
+    {
+      mulVal = MIN_COLOR_VALUE;
+      flagClip = true;
+    }
+    else if (mulVal > MAX_COLOR_VALUE)
+    {
+      mulVal = MAX_COLOR_VALUE;
+      flagClip = true;
+    }
+    dstRow[j] = static_cast<uint16_t>(mulVal);
+  }
+
+  return flagClip;
+}
+
+// Row and column are compared as unsigned, so negative ones fail too
+static uint32_t checkPointsScalar(
+     const RowColumnClass inRowCols[],
+     const int numPoints,
+     const int rowNum,
+     const int colNum
+     )
+{
+  uint32_t validBits = 0;
+
+  for (int k = 0; k < numPoints; k++)
+  {
+    bool isValid =
+         static_cast<unsigned>(inRowCols[k].getRow()) <
+         static_cast<unsigned>(rowNum) &&
+         static_cast<unsigned>(inRowCols[k].getCol()) <
+         static_cast<unsigned>(colNum);
+
+    validBits |= static_cast<uint32_t>(isValid) << k;
+  }
+
+  return validBits;
+}
+
+#ifdef IMAGE_X86_SIMD
+// Values never exceed 2 * MAX_COLOR_VALUE, so signed 16-bit compares and
+// 32-bit conversions are exact.
+
+__attribute__((target("sse4.1")))
+static bool addRowSse41(
+     uint16_t *dstRow,
+     const uint16_t *srcRow,
+     const int numVals
+     )
+{
+  const int numLanes = 8;
+  const __m128i maxVec = _mm_set1_epi16(MAX_COLOR_VALUE);
+  __m128i clipMask = _mm_setzero_si128();
+  int j;
+
+  for (j = 0; j + numLanes <= numVals; j += numLanes)
+  {
+    __m128i sumVec = _mm_add_epi16(
+         _mm_loadu_si128(reinterpret_cast<const __m128i*>(dstRow + j)),
+         _mm_loadu_si128(reinterpret_cast<const __m128i*>(srcRow + j)));
+
+    clipMask = _mm_or_si128(clipMask, _mm_cmpgt_epi16(sumVec, maxVec));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dstRow + j),
+                     _mm_min_epu16(sumVec, maxVec));
+  }
+
+  return addRowScalar(dstRow + j, srcRow + j, numVals - j) ||
+         !_mm_testz_si128(clipMask, clipMask);
+}
+
+__attribute__((target("sse4.1")))
+static bool subtractRowSse41(
+     uint16_t *dstRow,
+     const uint16_t *srcRow,
+     const int numVals
+     )
+{
+  const int numLanes = 8;
+  __m128i clipMask = _mm_setzero_si128();
+  int j;
+
+  for (j = 0; j + numLanes <= numVals; j += numLanes)
+  {
+    __m128i lhsVec =
+         _mm_loadu_si128(reinterpret_cast<const __m128i*>(dstRow + j));
+    __m128i rhsVec =
+         _mm_loadu_si128(reinterpret_cast<const __m128i*>(srcRow + j));
+
+    clipMask = _mm_or_si128(clipMask, _mm_cmpgt_epi16(rhsVec, lhsVec));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dstRow + j),
+                     _mm_subs_epu16(lhsVec, rhsVec));
+  }
+
+  return subtractRowScalar(dstRow + j, srcRow + j, numVals - j) ||
+         !_mm_testz_si128(clipMask, clipMask);
+}
+
+// Products are formed in double and truncated, exactly like the
+// static_cast<int> of the scalar form
+__attribute__((target("sse4.1")))
+static bool scaleRowSse41(
+     uint16_t *dstRow,
+     const double adjFactor,
+     const int numVals
+     )
+{
+  const int numLanes = 4;
+  const __m128d factorVec = _mm_set1_pd(adjFactor);
+  const __m128i minVec = _mm_set1_epi32(MIN_COLOR_VALUE);
+  const __m128i maxVec = _mm_set1_epi32(MAX_COLOR_VALUE);
+  __m128i clipMask = _mm_setzero_si128();
+  int j;
+
+  for (j = 0; j + numLanes <= numVals; j += numLanes)
+  {
+    __m128i inVec = _mm_cvtepu16_epi32(
+         _mm_loadl_epi64(reinterpret_cast<const __m128i*>(dstRow + j)));
+    __m128i lowVec = _mm_cvttpd_epi32(
+         _mm_mul_pd(_mm_cvtepi32_pd(inVec), factorVec));
+    __m128i highVec = _mm_cvttpd_epi32(
+         _mm_mul_pd(_mm_cvtepi32_pd(_mm_srli_si128(inVec, 8)), factorVec));
+    __m128i mulVec = _mm_unpacklo_epi64(lowVec, highVec);
+    __m128i clipVec = _mm_min_epi32(_mm_max_epi32(mulVec, minVec), maxVec);
+
+    clipMask = _mm_or_si128(clipMask, _mm_xor_si128(clipVec, mulVec));
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(dstRow + j),
+                     _mm_packus_epi32(clipVec, clipVec));
+  }
+
+  return scaleRowScalar(dstRow + j, adjFactor, numVals - j) ||
+         !_mm_testz_si128(clipMask, clipMask);
+}
+
+__attribute__((target("avx2")))
+static bool addRowAvx2(
+     uint16_t *dstRow,
+     const uint16_t *srcRow,
+     const int numVals
+     )
+{
+  const int numLanes = 16;
+  const __m256i maxVec = _mm256_set1_epi16(MAX_COLOR_VALUE);
+  __m256i clipMask = _mm256_setzero_si256();
+  int j;
+
+  for (j = 0; j + numLanes <= numVals; j += numLanes)
+  {
+    __m256i sumVec = _mm256_add_epi16(
+         _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dstRow + j)),
+         _mm256_loadu_si256(reinterpret_cast<const __m256i*>(srcRow + j)));
+
+    clipMask = _mm256_or_si256(clipMask, _mm256_cmpgt_epi16(sumVec, maxVec));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dstRow + j),
+                        _mm256_min_epu16(sumVec, maxVec));
+  }
+
+  return addRowScalar(dstRow + j, srcRow + j, numVals - j) ||
+         !_mm256_testz_si256(clipMask, clipMask);
+}
+
+__attribute__((target("avx2")))
+static bool subtractRowAvx2(
+     uint16_t *dstRow,
+     const uint16_t *srcRow,
+     const int numVals
+     )
+{
+  const int numLanes = 16;
+  __m256i clipMask = _mm256_setzero_si256();
+  int j;
+
+  for (j = 0; j + numLanes <= numVals; j += numLanes)
+  {
+    __m256i lhsVec =
+         _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dstRow + j));
+    __m256i rhsVec =
+         _mm256_loadu_si256(reinterpret_cast<const __m256i*>(srcRow + j));
+
+    clipMask = _mm256_or_si256(clipMask, _mm256_cmpgt_epi16(rhsVec, lhsVec));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dstRow + j),
+                        _mm256_subs_epu16(lhsVec, rhsVec));
+  }
+
+  return subtractRowScalar(dstRow + j, srcRow + j, numVals - j) ||
+         !_mm256_testz_si256(clipMask, clipMask);
+}
+
+__attribute__((target("avx2")))
+static bool scaleRowAvx2(
+     uint16_t *dstRow,
+     const double adjFactor,
+     const int numVals
+     )
+{
+  const int numLanes = 8;
+  const __m256d factorVec = _mm256_set1_pd(adjFactor);
+  const __m256i minVec = _mm256_set1_epi32(MIN_COLOR_VALUE);
+  const __m256i maxVec = _mm256_set1_epi32(MAX_COLOR_VALUE);
+  __m256i clipMask = _mm256_setzero_si256();
+  int j;
+
+  for (j = 0; j + numLanes <= numVals; j += numLanes)
+  {
+    __m256i inVec = _mm256_cvtepu16_epi32(
+         _mm_loadu_si128(reinterpret_cast<const __m128i*>(dstRow + j)));
+    __m128i lowVec = _mm256_cvttpd_epi32(_mm256_mul_pd(
+         _mm256_cvtepi32_pd(_mm256_castsi256_si128(inVec)), factorVec));
+    __m128i highVec = _mm256_cvttpd_epi32(_mm256_mul_pd(
+         _mm256_cvtepi32_pd(_mm256_extracti128_si256(inVec, 1)), factorVec));
+    __m256i mulVec = _mm256_inserti128_si256(
+         _mm256_castsi128_si256(lowVec), highVec, 1);
+    __m256i clipVec = _mm256_min_epi32(_mm256_max_epi32(mulVec, minVec),
+                                       maxVec);
+
+    clipMask = _mm256_or_si256(clipMask, _mm256_xor_si256(clipVec, mulVec));
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(dstRow + j),
+                     _mm_packus_epi32(_mm256_castsi256_si128(clipVec),
+                                      _mm256_extracti128_si256(clipVec, 1)));
+  }
+
+  return scaleRowScalar(dstRow + j, adjFactor, numVals - j) ||
+         !_mm256_testz_si256(clipMask, clipMask);
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static bool addRowAvx512(
+     uint16_t *dstRow,
+     const uint16_t *srcRow,
+     const int numVals
+     )
+{
+  const int numLanes = 32;
+  const __m512i maxVec = _mm512_set1_epi16(MAX_COLOR_VALUE);
+  __mmask32 clipMask = 0;
+  int j;
+
+  for (j = 0; j + numLanes <= numVals; j += numLanes)
+  {
+    __m512i sumVec = _mm512_add_epi16(_mm512_loadu_si512(dstRow + j),
+                                      _mm512_loadu_si512(srcRow + j));
+
+    clipMask |= _mm512_cmpgt_epu16_mask(sumVec, maxVec);
+    _mm512_storeu_si512(dstRow + j, _mm512_min_epu16(sumVec, maxVec));
+  }
+
+  return addRowScalar(dstRow + j, srcRow + j, numVals - j) || clipMask != 0;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static bool subtractRowAvx512(
+     uint16_t *dstRow,
+     const uint16_t *srcRow,
+     const int numVals
+     )
+{
+  const int numLanes = 32;
+  __mmask32 clipMask = 0;
+  int j;
+
+  for (j = 0; j + numLanes <= numVals; j += numLanes)
+  {
+    __m512i lhsVec = _mm512_loadu_si512(dstRow + j);
+    __m512i rhsVec = _mm512_loadu_si512(srcRow + j);
+
+    clipMask |= _mm512_cmpgt_epu16_mask(rhsVec, lhsVec);
+    _mm512_storeu_si512(dstRow + j, _mm512_subs_epu16(lhsVec, rhsVec));
+  }
+
+  return subtractRowScalar(dstRow + j, srcRow + j, numVals - j) ||
+         clipMask != 0;
+}
+
+__attribute__((target("avx512f,avx512bw")))
+static bool scaleRowAvx512(
+     uint16_t *dstRow,
+     const double adjFactor,
+     const int numVals
+     )
+{
+  const int numLanes = 16;
+  const __m512d factorVec = _mm512_set1_pd(adjFactor);
+  const __m512i minVec = _mm512_set1_epi32(MIN_COLOR_VALUE);
+  const __m512i maxVec = _mm512_set1_epi32(MAX_COLOR_VALUE);
+  __mmask16 clipMask = 0;
+  int j;
+
+  for (j = 0; j + numLanes <= numVals; j += numLanes)
+  {
+    __m512i inVec = _mm512_cvtepu16_epi32(
+         _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dstRow + j)));
+    __m256i lowVec = _mm512_cvttpd_epi32(_mm512_mul_pd(
+         _mm512_cvtepi32_pd(_mm512_castsi512_si256(inVec)), factorVec));
+    __m256i highVec = _mm512_cvttpd_epi32(_mm512_mul_pd(
+         _mm512_cvtepi32_pd(_mm512_extracti64x4_epi64(inVec, 1)),
+         factorVec));
+    __m512i mulVec = _mm512_inserti64x4(_mm512_castsi256_si512(lowVec),
+                                        highVec, 1);
+
+    clipMask |= _mm512_cmplt_epi32_mask(mulVec, minVec) |
+                _mm512_cmpgt_epi32_mask(mulVec, maxVec);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(dstRow + j),
+                        _mm512_cvtepi32_epi16(_mm512_min_epi32(
+                             _mm512_max_epi32(mulVec, minVec), maxVec)));
+  }
+
+  return scaleRowScalar(dstRow + j, adjFactor, numVals - j) ||
+         clipMask != 0;
+}
+
+// "RowColumnClass" is read as its two ints, row then column
+typedef char RowColumnIsTwoInts[
+     sizeof(RowColumnClass) == 2 * sizeof(int) ? 1 : -1];
+
+// Four locations per load. Flipping the sign bit turns the unsigned
+// compare into a signed one; the column result is then shifted onto the
+// row result so one bit per location comes out of the movemask.
+__attribute__((target("avx2")))
+static uint32_t checkPointsAvx2(
+     const RowColumnClass inRowCols[],
+     const int numPoints,
+     const int rowNum,
+     const int colNum
+     )
+{
+  const int numLanes = 4;
+  const int *pointVals = reinterpret_cast<const int*>(inRowCols);
+  const __m256i signVec = _mm256_set1_epi32(-2147483647 - 1);
+  const __m256i limitVec = _mm256_xor_si256(
+       _mm256_setr_epi32(rowNum, colNum, rowNum, colNum,
+                         rowNum, colNum, rowNum, colNum), signVec);
+  uint32_t validBits = 0;
+  int k;
+
+  for (k = 0; k + numLanes <= numPoints; k += numLanes)
+  {
+    __m256i pointVec = _mm256_xor_si256(
+         _mm256_loadu_si256(
+              reinterpret_cast<const __m256i*>(pointVals + 2 * k)),
+         signVec);
+    __m256i insideVec = _mm256_cmpgt_epi32(limitVec, pointVec);
+    __m256i bothVec = _mm256_and_si256(insideVec,
+                                       _mm256_slli_epi64(insideVec, 32));
+
+    validBits |= static_cast<uint32_t>(
+         _mm256_movemask_pd(_mm256_castsi256_pd(bothVec))) << k;
+  }
+  if (k < numPoints)
+  {
+    validBits |= checkPointsScalar(inRowCols + k, numPoints - k, rowNum,
+                                   colNum) << k;
+  }
+
+  return validBits;
+}
+#endif
+
+// Pick the widest kernels the running CPU supports
+static RowKernelsType selectRowKernels()
+{
+  RowKernelsType rowKernels;
+
+  rowKernels.addRow = addRowScalar;
+  rowKernels.subtractRow = subtractRowScalar;
+  rowKernels.scaleRow = scaleRowScalar;
+  rowKernels.checkPoints = checkPointsScalar;
+#ifdef IMAGE_X86_SIMD
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx2"))
+  {
+    rowKernels.checkPoints = checkPointsAvx2;
+  }
+  if (__builtin_cpu_supports("avx512bw"))
+  {
+    rowKernels.addRow = addRowAvx512;
+    rowKernels.subtractRow = subtractRowAvx512;
+    rowKernels.scaleRow = scaleRowAvx512;
+  }
+  else if (__builtin_cpu_supports("avx2"))
+  {
+    rowKernels.addRow = addRowAvx2;
+    rowKernels.subtractRow = subtractRowAvx2;
+    rowKernels.scaleRow = scaleRowAvx2;
+  }
+  else if (__builtin_cpu_supports("sse4.1"))
+  {
+    rowKernels.addRow = addRowSse41;
+    rowKernels.subtractRow = subtractRowSse41;
+    rowKernels.scaleRow = scaleRowSse41;
+  }
+#endif
+
+  return rowKernels;
+}
+
+static const RowKernelsType& getRowKernels()
+{
+  static const RowKernelsType rowKernels = selectRowKernels();
+
+  return rowKernels;
+}
+
+// ===== Image Thread Pool =====
+
+BandTaskClass::~BandTaskClass()
+{
+}
+
+// A "BandTaskClass" that calls one of the band bodies of
+// "ColorImageClass" with a fixed argument
+template <class ArgType>
+class ImageRowsTaskClass : public BandTaskClass
+{
+  public:
+    typedef bool (ColorImageClass::*RowsFuncType)(
+         const ArgType &inArg,
+         const int firstRow,
+         const int endRow
+         );
+
+    ImageRowsTaskClass(
+         ColorImageClass *inImgPtr,
+         RowsFuncType inRowsFunc,
+         const ArgType &inArg
+         ) : imgPtr(inImgPtr), rowsFunc(inRowsFunc), argRef(inArg)
+    {
+    }
+
+    bool runRows(
+         const int firstRow,
+         const int endRow
+         )
+    {
+      return (imgPtr->*rowsFunc)(argRef, firstRow, endRow);
+    }
+
+  private:
+    ColorImageClass *imgPtr;
+    RowsFuncType rowsFunc;
+    const ArgType &argRef;
+};
+
+// Threads that stay alive between operations and wait for the next task.
+// The calling thread works on each task too. Bands are claimed with an
+// atomic counter and their clip flags are OR'd together atomically, so no
+// lock is held while rows are processed.
+class ImageThreadPoolClass
+{
+  private:
+    // Member Attributes
+    int numThreads; // including the caller
+#ifdef IMAGE_THREADS
+    pthread_t workerIds[MAX_IMAGE_THREADS];
+    pthread_mutex_t runMutex; // one task at a time
+    pthread_mutex_t stateMutex;
+    pthread_cond_t startCond;
+    pthread_cond_t doneCond;
+    unsigned long taskSerial;
+    unsigned long startSerial; // taskSerial when the workers were made
+    int numBusy;
+    bool isStopping;
+#endif
+    BandTaskClass *taskPtr;
+    int taskRows;
+    int bandRows;
+    int numBands;
+    long nextBand;
+    int clipFlag;
+
+    // Private member function
+    // Claim and run bands until none are left
+    void workOnTask();
+#ifdef IMAGE_THREADS
+    static void* workerMain(
+         void *poolArg
+         );
+    void startWorkers(
+         const int inNumThreads
+         );
+    void stopWorkers();
+#endif
+
+    // Not copyable, it owns threads
+    ImageThreadPoolClass(
+         const ImageThreadPoolClass &rhsPool
+         );
+    ImageThreadPoolClass& operator=(
+         const ImageThreadPoolClass &rhsPool
+         );
+
+  public:
+    // Ctor starts one thread per online core
+    ImageThreadPoolClass();
+    // Dtor stops and joins the threads
+    ~ImageThreadPoolClass();
+
+    // Restart with "inNumThreads" threads, 0 for one per online core
+    void setThreadCount(
+         const int inNumThreads
+         );
+
+    // Run "inTask" over "inRows" rows in bands of "inBandRows" rows.
+    // Return true if any band clipped.
+    bool runTask(
+         BandTaskClass &inTask,
+         const int inRows,
+         const int inBandRows
+         );
+};
+
+ImageThreadPoolClass::ImageThreadPoolClass()
+{
+  numThreads = 1;
+#ifdef IMAGE_THREADS
+  pthread_mutex_init(&runMutex, 0);
+  pthread_mutex_init(&stateMutex, 0);
+  pthread_cond_init(&startCond, 0);
+  pthread_cond_init(&doneCond, 0);
+  taskSerial = 0;
+  startSerial = 0;
+  numBusy = 0;
+  isStopping = false;
+  startWorkers(0);
+#endif
+}
+
+ImageThreadPoolClass::~ImageThreadPoolClass()
+{
+#ifdef IMAGE_THREADS
+  stopWorkers();
+  pthread_cond_destroy(&doneCond);
+  pthread_cond_destroy(&startCond);
+  pthread_mutex_destroy(&stateMutex);
+  pthread_mutex_destroy(&runMutex);
+#endif
+}
+
+void ImageThreadPoolClass::setThreadCount(
+     const int inNumThreads
+     )
+{
+#ifdef IMAGE_THREADS
+  pthread_mutex_lock(&runMutex);
+  stopWorkers();
+  startWorkers(inNumThreads);
+  pthread_mutex_unlock(&runMutex);
+#else
+  (void)inNumThreads;
+#endif
+}
+
+void ImageThreadPoolClass::workOnTask()
+{
+  long bandIdx;
+  int firstRow;
+  int endRow;
+
+  while (true)
+  {
+#ifdef IMAGE_THREADS
+    bandIdx = __sync_fetch_and_add(&nextBand, 1);
+#else
+    bandIdx = nextBand++;
+#endif
+    if (bandIdx >= numBands)
+    {
+      break;
+    }
+    firstRow = static_cast<int>(bandIdx) * bandRows;
+    endRow = firstRow + bandRows < taskRows ? firstRow + bandRows : taskRows;
+    if (taskPtr->runRows(firstRow, endRow))
+    {
+#ifdef IMAGE_THREADS
+      __sync_fetch_and_or(&clipFlag, 1);
+#else
+      clipFlag = 1;
+#endif
+    }
+  }
+}
+
+bool ImageThreadPoolClass::runTask(
+     BandTaskClass &inTask,
+     const int inRows,
+     const int inBandRows
+     )
+{
+  bool flagClip;
+
+#ifdef IMAGE_THREADS
+  pthread_mutex_lock(&runMutex);
+#endif
+  taskPtr = &inTask;
+  taskRows = inRows;
+  bandRows = inBandRows < 1 ? 1 : inBandRows;
+  numBands = (taskRows + bandRows - 1) / bandRows;
+  nextBand = 0;
+  clipFlag = 0;
+
+#ifdef IMAGE_THREADS
+  // wake the workers, help out, then wait for the last one
+  pthread_mutex_lock(&stateMutex);
+  numBusy = numThreads - 1;
+  taskSerial++;
+  pthread_cond_broadcast(&startCond);
+  pthread_mutex_unlock(&stateMutex);
+
+  workOnTask();
+
+  pthread_mutex_lock(&stateMutex);
+  while (numBusy > 0)
+  {
+    pthread_cond_wait(&doneCond, &stateMutex);
+  }
+  pthread_mutex_unlock(&stateMutex);
+#else
+  workOnTask();
+#endif
+
+  flagClip = clipFlag != 0;
+#ifdef IMAGE_THREADS
+  pthread_mutex_unlock(&runMutex);
+#endif
+
+  return flagClip;
+}
+
+#ifdef IMAGE_THREADS
+void* ImageThreadPoolClass::workerMain(
+     void *poolArg
+     )
+{
+  ImageThreadPoolClass *poolPtr = static_cast<ImageThreadPoolClass*>(poolArg);
+  unsigned long seenSerial;
+
+  // a task may be posted before this thread first gets the lock, so start
+  // from the serial the pool had when the thread was made
+  pthread_mutex_lock(&poolPtr->stateMutex);
+  seenSerial = poolPtr->startSerial;
+  while (true)
+  {
+    while (poolPtr->taskSerial == seenSerial && !poolPtr->isStopping)
+    {
+      pthread_cond_wait(&poolPtr->startCond, &poolPtr->stateMutex);
+    }
+    if (poolPtr->isStopping)
+    {
+      break;
+    }
+    seenSerial = poolPtr->taskSerial;
+    pthread_mutex_unlock(&poolPtr->stateMutex);
+
+    poolPtr->workOnTask();
+
+    pthread_mutex_lock(&poolPtr->stateMutex);
+    poolPtr->numBusy--;
+    if (poolPtr->numBusy == 0)
+    {
+      pthread_cond_signal(&poolPtr->doneCond);
+    }
+  }
+  pthread_mutex_unlock(&poolPtr->stateMutex);
+
+  return 0;
+}
+
+// A worker that fails to start just leaves fewer threads
+void ImageThreadPoolClass::startWorkers(
+     const int inNumThreads
+     )
+{
+  int wantThreads = inNumThreads;
+
+  if (wantThreads <= 0)
+  {
+    wantThreads = static_cast<int>(sysconf(_SC_NPROCESSORS_ONLN));
+  }
+  if (wantThreads < 1)
+  {
+    wantThreads = 1;
+  }
+  if (wantThreads > MAX_IMAGE_THREADS)
+  {
+    wantThreads = MAX_IMAGE_THREADS;
+  }
+
+  isStopping = false;
+  startSerial = taskSerial;
+  numThreads = 1;
+  while (numThreads < wantThreads &&
+         pthread_create(&workerIds[numThreads], 0, workerMain, this) == 0)
+  {
+    numThreads++;
+  }
+}
+
+void ImageThreadPoolClass::stopWorkers()
+{
+  pthread_mutex_lock(&stateMutex);
+  isStopping = true;
+  pthread_cond_broadcast(&startCond);
+  pthread_mutex_unlock(&stateMutex);
+
+  for (int t = 1; t < numThreads; t++)
+  {
+    pthread_join(workerIds[t], 0);
+  }
+  numThreads = 1;
+}
+#endif
+
+// The pool, made on first use
+static ImageThreadPoolClass& imageThreadPool()
+{
+  static ImageThreadPoolClass threadPool;
+
+  return threadPool;
+}
+
+//This function runs "inTask" over the "numRows" rows of an image whose
+//plane rows hold "rowStride" values: in cache-sized bands on the thread
+//pool, or in one call on this thread when the image is small. Return true
+//if any value was clipped.
+static bool runRowBands(
+     BandTaskClass &inTask,
+     const int numRows,
+     const int rowStride
+     )
+{
+  size_t bandBytes = static_cast<size_t>(rowStride) * NUM_COLOR_CHANNELS *
+                     sizeof(uint16_t);
+  int bandRows;
+
+  if (numRows <= 0)
+  {
+    return false;
+  }
+  if (static_cast<size_t>(numRows) * rowStride < PARALLEL_MIN_PIXELS)
+  {
+    return inTask.runRows(0, numRows);
+  }
+
+  bandRows = static_cast<int>(BAND_TARGET_BYTES / bandBytes);
+
+  return imageThreadPool().runTask(inTask, numRows, bandRows);
+}
+
+// ===== PPM File =====
+
+// A whole file, read-only. It is mapped with mmap where there is one, so
+// the pages are read straight from the page cache; else it is read into
+// memory.
+class MappedFileClass
+{
+  private:
+    // Member Attributes
+    unsigned char *dataPtr;
+    size_t dataBytes;
+
+    // Not copyable, it owns the mapping
+    MappedFileClass(
+         const MappedFileClass &rhsFile
+         );
+    MappedFileClass& operator=(
+         const MappedFileClass &rhsFile
+         );
+
+  public:
+    // Ctor opens "fileName"; check "isOpen" for success
+    MappedFileClass(
+         const char *fileName
+         );
+    // Dtor unmaps the file
+    ~MappedFileClass();
+
+    bool isOpen() const;
+    const unsigned char* getData() const;
+    size_t getSize() const;
+};
+
+MappedFileClass::MappedFileClass(
+     const char *fileName
+     )
+{
+  dataPtr = 0;
+  dataBytes = 0;
+#ifdef IMAGE_MMAP
+  int fileDesc = open(fileName, O_RDONLY);
+  struct stat fileStat;
+  void *mapPtr;
+
+  if (fileDesc < 0)
+  {
+    return;
+  }
+  if (fstat(fileDesc, &fileStat) == 0 && fileStat.st_size > 0)
+  {
+    mapPtr = mmap(0, fileStat.st_size, PROT_READ, MAP_PRIVATE, fileDesc, 0);
+    if (mapPtr != MAP_FAILED)
+    {
+      madvise(mapPtr, fileStat.st_size, MADV_SEQUENTIAL);
+      dataPtr = static_cast<unsigned char*>(mapPtr);
+      dataBytes = fileStat.st_size;
+    }
+  }
+  // the mapping stays valid after the descriptor is closed
+  close(fileDesc);
+#else
+  FILE *inFile = fopen(fileName, "rb");
+  long fileBytes;
+
+  if (inFile == 0)
+  {
+    return;
+  }
+  if (fseek(inFile, 0, SEEK_END) == 0 && (fileBytes = ftell(inFile)) > 0 &&
+      fseek(inFile, 0, SEEK_SET) == 0)
+  {
+    dataPtr = new unsigned char[fileBytes];
+    dataBytes = fileBytes;
+    if (fread(dataPtr, 1, dataBytes, inFile) != dataBytes)
+    {
+      delete [] dataPtr;
+      dataPtr = 0;
+      dataBytes = 0;
+    }
+  }
+  fclose(inFile);
+#endif
+}
+
+MappedFileClass::~MappedFileClass()
+{
+  if (dataPtr != 0)
+  {
+#ifdef IMAGE_MMAP
+    munmap(dataPtr, dataBytes);
+#else
+    delete [] dataPtr;
+#endif
+  }
+}
+
+bool MappedFileClass::isOpen() const
+{
+  return dataPtr != 0;
+}
+
+const unsigned char* MappedFileClass::getData() const
+{
+  return dataPtr;
+}
+
+size_t MappedFileClass::getSize() const
+{
+  return dataBytes;
+}
+
+//This function reads the unsigned decimal at "posIdx" of the header,
+//skipping whitespace and '#' comments before it, into "outVal" and moves
+//"posIdx" past it. Return false if there is no number or it is over
+//"maxVal".
+static bool parsePpmNumber(
+     const unsigned char *dataPtr,
+     const size_t dataBytes,
+     size_t &posIdx,
+     const int maxVal,
+     int &outVal
+     )
+{
+  long numVal = 0;
+  size_t startIdx;
+
+  while (posIdx < dataBytes)
+  {
+    if (dataPtr[posIdx] == '#')
+    {
+      while (posIdx < dataBytes && dataPtr[posIdx] != '\n')
+      {
+        posIdx++;
+      }
+    }
+    else if (dataPtr[posIdx] == ' ' || dataPtr[posIdx] == '\t' ||
+             dataPtr[posIdx] == '\n' || dataPtr[posIdx] == '\r')
+    {
+      posIdx++;
+    }
+    else
+    {
+      break;
+    }
+  }
+
+  startIdx = posIdx;
+  while (posIdx < dataBytes && dataPtr[posIdx] >= '0' &&
+         dataPtr[posIdx] <= '9')
+  {
+    numVal = numVal * 10 + (dataPtr[posIdx] - '0');
+    if (numVal > maxVal)
+    {
+      return false;
+    }
+    posIdx++;
+  }
+  outVal = static_cast<int>(numVal);
+
+  return posIdx > startIdx;
+}
+
+//This function parses the PPM (P6) or PGM (P5) header at the start of the
+//"dataBytes" bytes at "dataPtr" into "outHeader". Return false if it is
+//not a valid header.
+static bool parsePpmHeader(
+     const unsigned char *dataPtr,
+     const size_t dataBytes,
+     PpmHeaderType &outHeader
+     )
+{
+  // a side longer than this cannot be held in an int plane index
+  const int maxSide = 1 << 20;
+  size_t posIdx = 2;
+
+  if (dataBytes < 2 || dataPtr[0] != 'P' ||
+      (dataPtr[1] != '6' && dataPtr[1] != '5'))
+  {
+    return false;
+  }
+  outHeader.numChannels = dataPtr[1] == '6' ? NUM_COLOR_CHANNELS : 1;
+
+  if (!parsePpmNumber(dataPtr, dataBytes, posIdx, maxSide,
+                      outHeader.colNum) ||
+      !parsePpmNumber(dataPtr, dataBytes, posIdx, maxSide,
+                      outHeader.rowNum) ||
+      !parsePpmNumber(dataPtr, dataBytes, posIdx, PPM_MAX_VAL,
+                      outHeader.maxVal) ||
+      outHeader.colNum < 1 || outHeader.rowNum < 1 || outHeader.maxVal < 1)
+  {
+    return false;
+  }
+  // exactly one whitespace byte ends the header
+  if (posIdx >= dataBytes ||
+      (dataPtr[posIdx] != ' ' && dataPtr[posIdx] != '\t' &&
+       dataPtr[posIdx] != '\n' && dataPtr[posIdx] != '\r'))
+  {
+    return false;
+  }
+  outHeader.bytesPerVal = outHeader.maxVal > 255 ? 2 : 1;
+  outHeader.dataOffset = posIdx + 1;
+
+  return true;
+}
+
+// Bytes of one row of samples
+static size_t ppmRowBytes(
+     const PpmHeaderType &ppmHeader
+     )
+{
+  return static_cast<size_t>(ppmHeader.colNum) * ppmHeader.numChannels *
+         ppmHeader.bytesPerVal;
+}
+
+// Whether a file of "fileBytes" bytes holds every sample the header says
+static bool ppmDataFits(
+     const PpmHeaderType &ppmHeader,
+     const size_t fileBytes
+     )
+{
+  return ppmHeader.dataOffset <= fileBytes &&
+         (fileBytes - ppmHeader.dataOffset) / ppmRowBytes(ppmHeader) >=
+         static_cast<size_t>(ppmHeader.rowNum);
+}
+
+//This function returns a new[] table taking every value a sample of
+//"ppmHeader" can hold to a color value. Samples over the maxval (invalid,
+//but seen in the wild) become MAX_COLOR_VALUE.
+static uint16_t* makePpmValTable(
+     const PpmHeaderType &ppmHeader
+     )
+{
+  int numEntries = ppmHeader.bytesPerVal == 2 ? PPM_MAX_VAL + 1 : 256;
+  uint16_t *valTable = new uint16_t[numEntries];
+
+  for (int v = 0; v < numEntries; v++)
+  {
+    valTable[v] = v >= ppmHeader.maxVal ? MAX_COLOR_VALUE :
+                  static_cast<uint16_t>(
+                       (static_cast<long>(v) * MAX_COLOR_VALUE +
+                        ppmHeader.maxVal / 2) / ppmHeader.maxVal);
+  }
+
+  return valTable;
+}
+
+// ===== PpmStripReaderClass Member Function =====
+
+// Ctor
+// Start with no file open
+PpmStripReaderClass::PpmStripReaderClass()
+{
+  filePtr = 0;
+  nextRow = 0;
+  stripBytes = 0;
+  stripCapacity = 0;
+  valTable = 0;
+  ppmHeader.rowNum = 0;
+  ppmHeader.colNum = 0;
+}
+
+// Dtor closes the file
+PpmStripReaderClass::~PpmStripReaderClass()
+{
+  closeFile();
+}
+
+// Open "fileName" and read its header
+bool PpmStripReaderClass::openFile(
+     const char *fileName
+     )
+{
+  unsigned char headerBytes[PPM_MAX_HEADER_BYTES];
+  size_t numRead;
+
+  closeFile();
+  filePtr = fopen(fileName, "rb");
+  if (filePtr == 0)
+  {
+    return false;
+  }
+  numRead = fread(headerBytes, 1, PPM_MAX_HEADER_BYTES, filePtr);
+  if (!parsePpmHeader(headerBytes, numRead, ppmHeader) ||
+      fseek(filePtr, static_cast<long>(ppmHeader.dataOffset), SEEK_SET) != 0)
+  {
+    closeFile();
+    return false;
+  }
+  valTable = makePpmValTable(ppmHeader);
+  nextRow = 0;
+
+  return true;
+}
+
+void PpmStripReaderClass::closeFile()
+{
+  if (filePtr != 0)
+  {
+    fclose(filePtr);
+    filePtr = 0;
+  }
+  delete [] stripBytes;
+  stripBytes = 0;
+  stripCapacity = 0;
+  delete [] valTable;
+  valTable = 0;
+  ppmHeader.rowNum = 0;
+  ppmHeader.colNum = 0;
+}
+
+// Size of the whole image in the file
+int PpmStripReaderClass::getRowNum() const
+{
+  return ppmHeader.rowNum;
+}
+
+int PpmStripReaderClass::getColNum() const
+{
+  return ppmHeader.colNum;
+}
+
+// Read the next (up to) "maxRows" rows into "outStrip"
+bool PpmStripReaderClass::readStrip(
+     const int maxRows,
+     ColorImageClass &outStrip
+     )
+{
+  PpmRowsArgType ppmArgs;
+  size_t rowBytes;
+  size_t numBytes;
+  int numRows;
+
+  if (filePtr == 0 || maxRows < 1 || nextRow >= ppmHeader.rowNum)
+  {
+    return false;
+  }
+  numRows = ppmHeader.rowNum - nextRow < maxRows ? ppmHeader.rowNum - nextRow :
+                                                   maxRows;
+  // a view cannot take the size of the strip
+  if (outStrip.isView &&
+      (outStrip.rowNum != numRows || outStrip.colNum != ppmHeader.colNum))
+  {
+    return false;
+  }
+  rowBytes = ppmRowBytes(ppmHeader);
+  numBytes = rowBytes * numRows;
+  if (numBytes > stripCapacity)
+  {
+    delete [] stripBytes;
+    stripBytes = 0;
+    stripCapacity = 0;
+    stripBytes = new unsigned char[numBytes];
+    stripCapacity = numBytes;
+  }
+  if (fread(stripBytes, 1, numBytes, filePtr) != numBytes)
+  {
+    return false;
+  }
+  nextRow += numRows;
+
+  outStrip.preparePixels(numRows, ppmHeader.colNum);
+  outStrip.markDirty();
+  ppmArgs.dataPtr = stripBytes;
+  ppmArgs.rowBytes = rowBytes;
+  ppmArgs.numChannels = ppmHeader.numChannels;
+  ppmArgs.bytesPerVal = ppmHeader.bytesPerVal;
+  ppmArgs.valTable = valTable;
+  outStrip.importPpmRows(ppmArgs, numRows);
+
+  return true;
+}
+
+// ===== Image Text =====
+
+// "00" to "99", so integers are written two digits at a time
+static const char DIGIT_PAIRS[] =
+  "0001020304050607080910111213141516171819"
+  "2021222324252627282930313233343536373839"
+  "4041424344454647484950515253545556575859"
+  "6061626364656667686970717273747576777879"
+  "8081828384858687888990919293949596979899";
+// Longest text of one pixel: "R: 1000 G: 1000 B: 1000--"
+const int MAX_PIXEL_TEXT_CHARS = 25;
+
+//This function writes "colorVal" (0 to 9999) in decimal at "dstPtr" and
+//returns the end of what it wrote.
+static char* appendColorText(
+     char *dstPtr,
+     const int colorVal
+     )
+{
+  if (colorVal < 10)
+  {
+    *dstPtr++ = static_cast<char>('0' + colorVal);
+  }
+  else if (colorVal < 100)
+  {
+    memcpy(dstPtr, DIGIT_PAIRS + 2 * colorVal, 2);
+    dstPtr += 2;
+  }
+  else if (colorVal < 1000)
+  {
+    *dstPtr++ = static_cast<char>('0' + colorVal / 100);
+    memcpy(dstPtr, DIGIT_PAIRS + 2 * (colorVal % 100), 2);
+    dstPtr += 2;
+  }
+  else
+  {
+    memcpy(dstPtr, DIGIT_PAIRS + 2 * (colorVal / 100), 2);
+    memcpy(dstPtr + 2, DIGIT_PAIRS + 2 * (colorVal % 100), 2);
+    dstPtr += 4;
+  }
+
+  return dstPtr;
+}
+
+//This function writes one pixel the way "ColorClass::printComponentValues"
+//prints it ("R: <r> G: <g> B: <b>") at "dstPtr" and returns the end of
+//what it wrote.
+static char* appendPixelText(
+     char *dstPtr,
+     const int redVal,
+     const int greenVal,
+     const int blueVal
+     )
+{
+  memcpy(dstPtr, "R: ", 3);
+  dstPtr = appendColorText(dstPtr + 3, redVal);
+  memcpy(dstPtr, " G: ", 4);
+  dstPtr = appendColorText(dstPtr + 4, greenVal);
+  memcpy(dstPtr, " B: ", 4);
+
+  return appendColorText(dstPtr + 4, blueVal);
+}
+
+// ===== ColorImageClass Member Function =====
+
+// The built-in pool, made on first use so it outlives every image
+static PixelAllocatorClass* defaultPixelPool()
+{
+  static PixelPoolClass pixelPool;
+
+  return &pixelPool;
+}
+
+// The allocator new images use, 0 for the built-in pool
+PixelAllocatorClass *ColorImageClass::currentAllocator = 0;
+
+//This function adds "deltaVal" to the share count at "countPtr" and
+//returns the new count. Images on different threads may share a buffer,
+//so the update is atomic.
+static int addShareCount(
+     int *countPtr,
+     const int deltaVal
+     )
+{
+#ifdef IMAGE_THREADS
+  return __sync_add_and_fetch(countPtr, deltaVal);
+#else
+  *countPtr += deltaVal;
+  return *countPtr;
+#endif
+}
+
+//This function returns a stamp later than every one returned before. Images
+//on different threads may change at once, so the count is atomic.
+static uint64_t nextDirtyStamp()
+{
+  static uint64_t lastStamp = 0;
+
+#ifdef IMAGE_THREADS
+  return __sync_add_and_fetch(&lastStamp, 1);
+#else
+  return ++lastStamp;
+#endif
+}
+
+// Allocate the planes for "inRowNum" x "inColNum" pixels, all black
+void ColorImageClass::allocatePixels(
+     const int inRowNum,
+     const int inColNum,
+     const bool isCleared
+     )
+{
+  int alignVals = PIXEL_ALIGN_BYTES / sizeof(uint16_t);
+  PixelAllocatorClass *newAllocator = currentAllocator != 0 ?
+                                      currentAllocator : defaultPixelPool();
+  void *blockPtr;
+
+  rowNum = inRowNum < 1 ? 1 : inRowNum;
+  colNum = inColNum < 1 ? 1 : inColNum;
+  rowStride = (colNum + alignVals - 1) / alignVals * alignVals;
+  planeStep = static_cast<size_t>(rowNum) * rowStride;
+  blockPtr = newAllocator->allocateBuffer(PIXEL_HEADER_BYTES + bufferBytes());
+  if (blockPtr == 0)
+  {
+    throw bad_alloc();
+  }
+  allocatorPtr = newAllocator;
+  isView = false;
+  isSolid = false;
+  numSolidEdits = 0;
+  pixelHeader = static_cast<PixelHeaderType*>(blockPtr);
+  pixelHeader->shareCount = 1;
+  pixelHeader->hasViews = false;
+  pixelBuffer = reinterpret_cast<uint16_t*>(
+       static_cast<char*>(blockPtr) + PIXEL_HEADER_BYTES);
+
+  if (isCleared)
+  {
+    // black, and the padding is 0 as well
+    int unusedArg = 0;
+    ImageRowsTaskClass<int> clearTask(this, &ColorImageClass::clearRows,
+                                      unusedArg);
+
+    runRowBands(clearTask, rowNum, rowStride);
+  }
+}
+
+// Drop this image's share of the buffer. A view holds no share.
+void ColorImageClass::releasePixels()
+{
+  if (pixelBuffer != 0 && !isView &&
+      addShareCount(&pixelHeader->shareCount, -1) == 0)
+  {
+    allocatorPtr->releaseBuffer(pixelHeader,
+                                PIXEL_HEADER_BYTES + bufferBytes());
+  }
+  pixelBuffer = 0;
+  pixelHeader = 0;
+  isView = false;
+  isSolid = false;
+  numSolidEdits = 0;
+}
+
+// Share the buffer of "rhsImg", or copy its pixels if it is a view or has
+// views
+void ColorImageClass::sharePixels(
+     const ColorImageClass &rhsImg
+     )
+{
+  if (rhsImg.isView ||
+      (rhsImg.pixelHeader != 0 && rhsImg.pixelHeader->hasViews))
+  {
+    allocatePixels(rhsImg.rowNum, rhsImg.colNum);
+    copyPixels(rhsImg);
+    return;
+  }
+  if (rhsImg.isSolid)
+  {
+    // the edits are few, so they are copied rather than shared
+    makeSolid(rhsImg.rowNum, rhsImg.colNum, rhsImg.solidVals);
+    reserveSolidEdits(rhsImg.numSolidEdits);
+    if (rhsImg.numSolidEdits > 0)
+    {
+      memcpy(solidEdits, rhsImg.solidEdits,
+             rhsImg.numSolidEdits * sizeof(SolidEditType));
+    }
+    numSolidEdits = rhsImg.numSolidEdits;
+    return;
+  }
+
+  rowNum = rhsImg.rowNum;
+  colNum = rhsImg.colNum;
+  rowStride = rhsImg.rowStride;
+  planeStep = rhsImg.planeStep;
+  pixelBuffer = rhsImg.pixelBuffer;
+  pixelHeader = rhsImg.pixelHeader;
+  allocatorPtr = rhsImg.allocatorPtr;
+  isView = false;
+  if (pixelBuffer != 0)
+  {
+    addShareCount(&pixelHeader->shareCount, 1);
+  }
+}
+
+// Copy the pixels into a buffer of the image's own if the buffer is
+// shared. The old share is dropped only after the copy, so two images
+// unsharing at once on different threads are both safe.
+void ColorImageClass::unsharePixels()
+{
+  if (isSolid)
+  {
+    densifyPixels();
+    return;
+  }
+  if (pixelBuffer == 0 || isView ||
+      addShareCount(&pixelHeader->shareCount, 0) == 1)
+  {
+    return;
+  }
+
+  const uint16_t *sharedBuffer = pixelBuffer;
+  PixelHeaderType *sharedHeader = pixelHeader;
+  PixelAllocatorClass *sharedAllocator = allocatorPtr;
+
+  allocatePixels(rowNum, colNum, false);
+  memcpy(pixelBuffer, sharedBuffer, bufferBytes());
+  if (addShareCount(&sharedHeader->shareCount, -1) == 0)
+  {
+    sharedAllocator->releaseBuffer(sharedHeader,
+                                   PIXEL_HEADER_BYTES + bufferBytes());
+  }
+}
+
+// Make the image an unshared buffer of the given size
+void ColorImageClass::preparePixels(
+     const int inRowNum,
+     const int inColNum
+     )
+{
+  if (isView)
+  {
+    return;
+  }
+  if (pixelBuffer == 0 || inRowNum != rowNum || inColNum != colNum ||
+      addShareCount(&pixelHeader->shareCount, 0) != 1)
+  {
+    releasePixels();
+    allocatePixels(inRowNum, inColNum);
+  }
+}
+
+// Copy "rhsImg" into the image where they overlap
+void ColorImageClass::copyPixels(
+     const ColorImageClass &rhsImg
+     )
+{
+  ImageRowsTaskClass<ColorImageClass> copyTask(
+       this, &ColorImageClass::copyRows, rhsImg);
+  int overlapRow = rowNum < rhsImg.rowNum ? rowNum : rhsImg.rowNum;
+
+  runRowBands(copyTask, overlapRow, rowStride);
+}
+
+// Whether "rhsImg" is another part of the same buffer
+bool ColorImageClass::overlapsShifted(
+     const ColorImageClass &rhsImg
+     ) const
+{
+  return pixelHeader != 0 && rhsImg.pixelHeader == pixelHeader &&
+         rhsImg.pixelBuffer != pixelBuffer;
+}
+
+//This function sets "outVals" to the channel values of "inColor".
+static void colorToVals(
+     const ColorClass &inColor,
+     uint16_t outVals[]
+     )
+{
+  outVals[CHANNEL_RED] = static_cast<uint16_t>(inColor.getRed());
+  outVals[CHANNEL_GREEN] = static_cast<uint16_t>(inColor.getGreen());
+  outVals[CHANNEL_BLUE] = static_cast<uint16_t>(inColor.getBlue());
+}
+
+//This function adds the color values "rhsVals" to "dstVals", or subtracts
+//them if "opType" is EXPR_SUBTRACT, the way the row kernels do. It
+//returns true if any value was clipped.
+static bool combineColorVals(
+     uint16_t dstVals[],
+     const uint16_t rhsVals[],
+     const int opType
+     )
+{
+  if (opType == EXPR_SUBTRACT)
+  {
+    return subtractRowScalar(dstVals, rhsVals, NUM_COLOR_CHANNELS);
+  }
+
+  return addRowScalar(dstVals, rhsVals, NUM_COLOR_CHANNELS);
+}
+
+// Whether the image may drop its planes for the solid form
+bool ColorImageClass::canBeSolid() const
+{
+  return !isView && (pixelHeader == 0 || !pixelHeader->hasViews);
+}
+
+// Make the image a solid image of "inVals"
+void ColorImageClass::makeSolid(
+     const int inRowNum,
+     const int inColNum,
+     const uint16_t inVals[]
+     )
+{
+  releasePixels();
+  rowNum = inRowNum < 1 ? 1 : inRowNum;
+  colNum = inColNum < 1 ? 1 : inColNum;
+  rowStride = 0;
+  planeStep = 0;
+  allocatorPtr = 0;
+  isSolid = true;
+  for (int c = 0; c < NUM_COLOR_CHANNELS; c++)
+  {
+    solidVals[c] = inVals[c];
+  }
+}
+
+// Most edits the image holds before dense planes are cheaper
+int ColorImageClass::maxSolidEdits() const
+{
+  size_t maxEdits = static_cast<size_t>(rowNum) * colNum /
+                    SOLID_PIXELS_PER_EDIT;
+
+  return maxEdits < static_cast<size_t>(SOLID_MAX_EDITS) ?
+         static_cast<int>(maxEdits) : SOLID_MAX_EDITS;
+}
+
+// Pixel index of location ("rowIdx", "colIdx") in the solid form,
+// computed in size_t since a solid image can be far larger than INT_MAX
+// pixels
+size_t ColorImageClass::solidPixelIdx(
+     const int rowIdx,
+     const int colIdx
+     ) const
+{
+  return static_cast<size_t>(rowIdx) * colNum + colIdx;
+}
+
+// Index of the first edit at or after pixel "pixelIdx", by binary search
+int ColorImageClass::findSolidEdit(
+     const size_t pixelIdx
+     ) const
+{
+  int lowIdx = 0;
+  int highIdx = numSolidEdits;
+
+  while (lowIdx < highIdx)
+  {
+    int midIdx = lowIdx + (highIdx - lowIdx) / 2;
+
+    if (solidEdits[midIdx].pixelIdx < pixelIdx)
+    {
+      lowIdx = midIdx + 1;
+    }
+    else
+    {
+      highIdx = midIdx;
+    }
+  }
+
+  return lowIdx;
+}
+
+// Make room for "numEdits" edits, doubling the list as it grows
+void ColorImageClass::reserveSolidEdits(
+     const int numEdits
+     )
+{
+  SolidEditType *newEdits;
+  int newCapacity;
+
+  if (numEdits <= solidEditCapacity)
+  {
+    return;
+  }
+  newCapacity = solidEditCapacity < 8 ? 8 : solidEditCapacity;
+  while (newCapacity < numEdits)
+  {
+    newCapacity *= 2;
+  }
+  newEdits = new SolidEditType[newCapacity];
+  if (numSolidEdits > 0)
+  {
+    memcpy(newEdits, solidEdits, numSolidEdits * sizeof(SolidEditType));
+  }
+  delete [] solidEdits;
+  solidEdits = newEdits;
+  solidEditCapacity = newCapacity;
+}
+
+// Set pixel "pixelIdx" of a solid image to "inVals". A pixel set back to
+// the solid color drops its edit.
+bool ColorImageClass::setSolidEdit(
+     const size_t pixelIdx,
+     const uint16_t inVals[]
+     )
+{
+  int editIdx = findSolidEdit(pixelIdx);
+  bool isFound = editIdx < numSolidEdits &&
+                 solidEdits[editIdx].pixelIdx == pixelIdx;
+
+  if (memcmp(inVals, solidVals, sizeof(solidVals)) == 0)
+  {
+    if (isFound)
+    {
+      memmove(solidEdits + editIdx, solidEdits + editIdx + 1,
+              (numSolidEdits - editIdx - 1) * sizeof(SolidEditType));
+      numSolidEdits--;
+    }
+    return true;
+  }
+
+  if (!isFound)
+  {
+    if (numSolidEdits >= maxSolidEdits())
+    {
+      return false;
+    }
+    reserveSolidEdits(numSolidEdits + 1);
+    memmove(solidEdits + editIdx + 1, solidEdits + editIdx,
+            (numSolidEdits - editIdx) * sizeof(SolidEditType));
+    numSolidEdits++;
+    solidEdits[editIdx].pixelIdx = pixelIdx;
+  }
+  memcpy(solidEdits[editIdx].colorVals, inVals, sizeof(solidVals));
+
+  return true;
+}
+
+// Color values of pixel "pixelIdx" of a solid image
+const uint16_t* ColorImageClass::solidPixel(
+     const size_t pixelIdx
+     ) const
+{
+  int editIdx = findSolidEdit(pixelIdx);
+
+  if (editIdx < numSolidEdits && solidEdits[editIdx].pixelIdx == pixelIdx)
+  {
+    return solidEdits[editIdx].colorVals;
+  }
+
+  return solidVals;
+}
+
+// Give a solid image planes: fill them with the solid color, then write
+// the edits
+void ColorImageClass::densifyPixels()
+{
+  ColorClass solidColor(solidVals[CHANNEL_RED], solidVals[CHANNEL_GREEN],
+                        solidVals[CHANNEL_BLUE]);
+  ImageRowsTaskClass<ColorClass> fillTask(this, &ColorImageClass::fillRows,
+                                          solidColor);
+  int numEdits = numSolidEdits;
+
+  if (!isSolid)
+  {
+    return;
+  }
+  allocatePixels(rowNum, colNum);
+  runRowBands(fillTask, rowNum, rowStride);
+  for (int n = 0; n < numEdits; n++)
+  {
+    int rowLoc = static_cast<int>(solidEdits[n].pixelIdx / colNum);
+    int colLoc = static_cast<int>(solidEdits[n].pixelIdx % colNum);
+
+    for (int c = 0; c < NUM_COLOR_CHANNELS; c++)
+    {
+      planeRow(c, rowLoc)[colLoc] = solidEdits[n].colorVals[c];
+    }
+  }
+}
+
+// Whether "rhsImg" can be added or subtracted in the solid form
+bool ColorImageClass::canCombineSolid(
+     const ColorImageClass &rhsImg
+     ) const
+{
+  return isSolid && rhsImg.isSolid &&
+         rhsImg.rowNum >= rowNum && rhsImg.colNum >= colNum &&
+         numSolidEdits + rhsImg.numSolidEdits <= maxSolidEdits();
+}
+
+// Merge the two edit lists in pixel order. Pixels neither image edits
+// all take the combined solid color; an edit whose result is that color
+// is dropped.
+bool ColorImageClass::combineSolid(
+     const ColorImageClass &rhsImg,
+     const int opType
+     )
+{
+  size_t numPixels = static_cast<size_t>(rowNum) * colNum;
+  size_t numEdited = 0;
+  uint16_t newSolidVals[NUM_COLOR_CHANNELS];
+  int newCapacity = numSolidEdits + rhsImg.numSolidEdits;
+  SolidEditType *newEdits = new SolidEditType[newCapacity > 0 ? newCapacity :
+                                                                1];
+  int numNewEdits = 0;
+  int lhsIdx = 0;
+  int rhsIdx = 0;
+  bool solidClip;
+  bool flagClip = false;
+
+  memcpy(newSolidVals, solidVals, sizeof(solidVals));
+  solidClip = combineColorVals(newSolidVals, rhsImg.solidVals, opType);
+
+  while (lhsIdx < numSolidEdits || rhsIdx < rhsImg.numSolidEdits)
+  {
+    bool hasLhs = lhsIdx < numSolidEdits;
+    bool hasRhs = rhsIdx < rhsImg.numSolidEdits;
+    size_t lhsPixel = hasLhs ? solidEdits[lhsIdx].pixelIdx : 0;
+    size_t rhsPixel = 0;
+    size_t pixelIdx;
+    uint16_t pixelVals[NUM_COLOR_CHANNELS];
+    const uint16_t *rhsVals = rhsImg.solidVals;
+
+    if (hasRhs)
+    {
+      // as a pixel of this image; "rhsImg" may be larger
+      size_t rhsRow = rhsImg.solidEdits[rhsIdx].pixelIdx / rhsImg.colNum;
+      size_t rhsCol = rhsImg.solidEdits[rhsIdx].pixelIdx % rhsImg.colNum;
+
+      if (rhsRow >= static_cast<size_t>(rowNum) ||
+          rhsCol >= static_cast<size_t>(colNum))
+      {
+        rhsIdx = rhsRow >= static_cast<size_t>(rowNum) ?
+                 rhsImg.numSolidEdits : rhsIdx + 1;
+        continue;
+      }
+      rhsPixel = rhsRow * colNum + rhsCol;
+    }
+
+    // take whichever edit comes first; both when they are the same pixel
+    hasLhs = hasLhs && (!hasRhs || lhsPixel <= rhsPixel);
+    hasRhs = hasRhs && (!hasLhs || rhsPixel <= lhsPixel);
+    pixelIdx = hasLhs ? lhsPixel : rhsPixel;
+    memcpy(pixelVals, solidVals, sizeof(pixelVals));
+    if (hasLhs)
+    {
+      memcpy(pixelVals, solidEdits[lhsIdx].colorVals, sizeof(pixelVals));
+      lhsIdx++;
+    }
+    if (hasRhs)
+    {
+      rhsVals = rhsImg.solidEdits[rhsIdx].colorVals;
+      rhsIdx++;
+    }
+    flagClip = combineColorVals(pixelVals, rhsVals, opType) || flagClip;
+    numEdited++;
+
+    if (memcmp(pixelVals, newSolidVals, sizeof(pixelVals)) != 0)
+    {
+      newEdits[numNewEdits].pixelIdx = pixelIdx;
+      memcpy(newEdits[numNewEdits].colorVals, pixelVals, sizeof(pixelVals));
+      numNewEdits++;
+    }
+  }
+  // the solid color only counts if some pixel still has it on both sides
+  flagClip = flagClip || (solidClip && numEdited < numPixels);
+
+  // "rhsImg" may be the object, so its edits are only dropped now
+  delete [] solidEdits;
+  solidEdits = newEdits;
+  solidEditCapacity = newCapacity > 0 ? newCapacity : 1;
+  numSolidEdits = numNewEdits;
+  memcpy(solidVals, newSolidVals, sizeof(solidVals));
+
+  return flagClip;
+}
+
+// Values of a plane row, from the plane or the solid form
+const uint16_t* ColorImageClass::rowVals(
+     const int channelIdx,
+     const int rowIdx,
+     const int firstCol,
+     const int numVals,
+     uint16_t scratchVals[]
+     ) const
+{
+  size_t firstPixel;
+
+  if (!isSolid)
+  {
+    return planeRow(channelIdx, rowIdx) + firstCol;
+  }
+  firstPixel = solidPixelIdx(rowIdx, firstCol);
+
+  // fill by doubling copies, which run at memcpy speed
+  scratchVals[0] = solidVals[channelIdx];
+  for (int numFilled = 1; numFilled < numVals; numFilled *= 2)
+  {
+    memcpy(scratchVals + numFilled, scratchVals,
+           (numVals - numFilled < numFilled ? numVals - numFilled :
+                                              numFilled) * sizeof(uint16_t));
+  }
+  for (int n = findSolidEdit(firstPixel);
+       n < numSolidEdits && solidEdits[n].pixelIdx < firstPixel + numVals;
+       n++)
+  {
+    scratchVals[solidEdits[n].pixelIdx - firstPixel] =
+         solidEdits[n].colorVals[channelIdx];
+  }
+
+  return scratchVals;
+}
+
+// Whether "addImages" of these inputs can work in the solid form: all
+// solid and covering the object
+bool ColorImageClass::canSumSolid(
+     const int numImgsToAdd,
+     const ColorImageClass imagesToAdd[]
+     ) const
+{
+  bool isAllSolid = canBeSolid();
+
+  for (int k = 0; k < numImgsToAdd; k++)
+  {
+    isAllSolid = isAllSolid && imagesToAdd[k].isSolid &&
+                 imagesToAdd[k].rowNum >= rowNum &&
+                 imagesToAdd[k].colNum >= colNum;
+  }
+
+  return isAllSolid;
+}
+
+// Start with no change recorded, in tiles of the image's own
+void ColorImageClass::initDirtyTiles()
+{
+  ownDirty.wholeStamp = 0;
+  ownDirty.tileStamps = 0;
+  ownDirty.numTileRows = 0;
+  ownDirty.numTileCols = 0;
+  dirtyTiles = &ownDirty;
+  dirtyOriginRow = 0;
+  dirtyOriginCol = 0;
+}
+
+// Record that the whole image changed. The tiles are kept unless the size
+// changed; the whole-image stamp is later than any of them.
+void ColorImageClass::markDirty()
+{
+  int newTileRows = (rowNum + DIRTY_TILE_ROWS - 1) / DIRTY_TILE_ROWS;
+  int newTileCols = (colNum + DIRTY_TILE_COLS - 1) / DIRTY_TILE_COLS;
+
+  if (isView)
+  {
+    markDirtyRegion(nextDirtyStamp(), 0, rowNum, 0, colNum);
+    return;
+  }
+  if (newTileRows != ownDirty.numTileRows ||
+      newTileCols != ownDirty.numTileCols)
+  {
+    delete [] ownDirty.tileStamps;
+    ownDirty.tileStamps = 0;
+    ownDirty.numTileRows = newTileRows;
+    ownDirty.numTileCols = newTileCols;
+  }
+  ownDirty.wholeStamp = nextDirtyStamp();
+}
+
+// Record that a region changed: every tile it touches takes "dirtyStamp"
+void ColorImageClass::markDirtyRegion(
+     const uint64_t dirtyStamp,
+     const int firstRow,
+     const int endRow,
+     const int firstCol,
+     const int endCol
+     )
+{
+  DirtyTilesType &dirtyRef = *dirtyTiles;
+  size_t numTiles = static_cast<size_t>(dirtyRef.numTileRows) *
+                    dirtyRef.numTileCols;
+  int firstTileRow = (dirtyOriginRow + firstRow) / DIRTY_TILE_ROWS;
+  int endTileRow = (dirtyOriginRow + endRow - 1) / DIRTY_TILE_ROWS + 1;
+  int firstTileCol = (dirtyOriginCol + firstCol) / DIRTY_TILE_COLS;
+  int endTileCol = (dirtyOriginCol + endCol - 1) / DIRTY_TILE_COLS + 1;
+
+  if (firstRow >= endRow || firstCol >= endCol || numTiles == 0)
+  {
+    return;
+  }
+  if (dirtyRef.tileStamps == 0)
+  {
+    dirtyRef.tileStamps = new uint64_t[numTiles];
+    memset(dirtyRef.tileStamps, 0, numTiles * sizeof(uint64_t));
+  }
+
+  for (int ti = firstTileRow; ti < endTileRow; ti++)
+  {
+    uint64_t *stampPtr = dirtyRef.tileStamps +
+                         static_cast<size_t>(ti) * dirtyRef.numTileCols;
+
+    for (int tj = firstTileCol; tj < endTileCol; tj++)
+    {
+      stampPtr[tj] = dirtyStamp;
+    }
+  }
+}
+
+// Stamp of the last change to a region or to the whole image
+uint64_t ColorImageClass::regionStamp(
+     const int firstRow,
+     const int endRow,
+     const int firstCol,
+     const int endCol
+     ) const
+{
+  const DirtyTilesType &dirtyRef = *dirtyTiles;
+  uint64_t lastStamp = dirtyRef.wholeStamp;
+  int clipEndRow = endRow < rowNum ? endRow : rowNum;
+  int clipEndCol = endCol < colNum ? endCol : colNum;
+
+  if (dirtyRef.tileStamps == 0 || firstRow >= clipEndRow ||
+      firstCol >= clipEndCol)
+  {
+    return lastStamp;
+  }
+
+  for (int ti = (dirtyOriginRow + firstRow) / DIRTY_TILE_ROWS;
+       ti <= (dirtyOriginRow + clipEndRow - 1) / DIRTY_TILE_ROWS; ti++)
+  {
+    const uint64_t *stampPtr = dirtyRef.tileStamps +
+                               static_cast<size_t>(ti) * dirtyRef.numTileCols;
+
+    for (int tj = (dirtyOriginCol + firstCol) / DIRTY_TILE_COLS;
+         tj <= (dirtyOriginCol + clipEndCol - 1) / DIRTY_TILE_COLS; tj++)
+    {
+      lastStamp = stampPtr[tj] > lastStamp ? stampPtr[tj] : lastStamp;
+    }
+  }
+
+  return lastStamp;
+}
+
+// Bytes held by the planes
+size_t ColorImageClass::bufferBytes() const
+{
+  return NUM_COLOR_CHANNELS * planeSize() * sizeof(uint16_t);
+}
+
+// Values from the start of one plane to the next
+size_t ColorImageClass::planeSize() const
+{
+  return planeStep;
+}
+
+// Start of row "rowIdx" in the plane of channel "channelIdx"
+uint16_t* ColorImageClass::planeRow(
+     const int channelIdx,
+     const int rowIdx
+     )
+{
+  return pixelBuffer + channelIdx * planeSize() +
+         static_cast<size_t>(rowIdx) * rowStride;
+}
+
+const uint16_t* ColorImageClass::planeRow(
+     const int channelIdx,
+     const int rowIdx
+     ) const
+{
+  return pixelBuffer + channelIdx * planeSize() +
+         static_cast<size_t>(rowIdx) * rowStride;
+}
+
+// Ctor
+// Default ctor set all pixels to full black
+ColorImageClass::ColorImageClass(
+     ) : isSolid(false), solidEdits(0), numSolidEdits(0), solidEditCapacity(0)
+{
+  uint16_t blackVals[NUM_COLOR_CHANNELS] = {0, 0, 0};
+
+  pixelBuffer = 0;
+  isView = false;
+  initDirtyTiles();
+  makeSolid(IMAGE_ROW_NUM, IMAGE_COL_NUM, blackVals);
+  markDirty();
+}
+
+// Value ctor makes an all black image of the given size; no planes are
+// allocated until they are needed
+ColorImageClass::ColorImageClass(
+     const int inRowNum,
+     const int inColNum
+     ) : isSolid(false), solidEdits(0), numSolidEdits(0), solidEditCapacity(0)
+{
+  uint16_t blackVals[NUM_COLOR_CHANNELS] = {0, 0, 0};
+
+  pixelBuffer = 0;
+  isView = false;
+  initDirtyTiles();
+  makeSolid(inRowNum, inColNum, blackVals);
+  markDirty();
+}
+
+// Copy ctor shares the buffer of "rhsImg"
+ColorImageClass::ColorImageClass(
+     const ColorImageClass &rhsImg
+     ) : isSolid(false), solidEdits(0), numSolidEdits(0), solidEditCapacity(0)
+{
+  pixelBuffer = 0;
+  isView = false;
+  initDirtyTiles();
+  sharePixels(rhsImg);
+  markDirty();
+}
+
+// View ctor: a rectangle of "parentImg", cut to fit inside it
+ColorImageClass::ColorImageClass(
+     const ColorImageClass &parentImg,
+     const RowColumnClass &originRowCol,
+     const int inRowNum,
+     const int inColNum
+     ) : isSolid(false), solidEdits(0), numSolidEdits(0), solidEditCapacity(0)
+{
+  int originRow = originRowCol.getRow();
+  int originCol = originRowCol.getCol();
+
+  originRow = originRow < 0 ? 0 : originRow;
+  originRow = originRow > parentImg.rowNum ? parentImg.rowNum : originRow;
+  originCol = originCol < 0 ? 0 : originCol;
+  originCol = originCol > parentImg.colNum ? parentImg.colNum : originCol;
+  rowNum = inRowNum < 0 ? 0 : inRowNum;
+  rowNum = rowNum > parentImg.rowNum - originRow ?
+           parentImg.rowNum - originRow : rowNum;
+  colNum = inColNum < 0 ? 0 : inColNum;
+  colNum = colNum > parentImg.colNum - originCol ?
+           parentImg.colNum - originCol : colNum;
+  if (rowNum == 0 || colNum == 0)
+  {
+    rowNum = 0;
+    colNum = 0;
+  }
+
+  rowStride = parentImg.rowStride;
+  planeStep = parentImg.planeStep;
+  pixelBuffer = parentImg.pixelBuffer;
+  if (pixelBuffer != 0)
+  {
+    pixelBuffer += static_cast<size_t>(originRow) * rowStride + originCol;
+  }
+  pixelHeader = parentImg.pixelHeader;
+  allocatorPtr = parentImg.allocatorPtr;
+  isView = true;
+
+  // changes are recorded in the tiles of the outermost image
+  initDirtyTiles();
+  dirtyTiles = parentImg.dirtyTiles;
+  dirtyOriginRow = parentImg.dirtyOriginRow + originRow;
+  dirtyOriginCol = parentImg.dirtyOriginCol + originCol;
+}
+
+// Give "parentImg" a buffer no copy shares, now or later
+ColorImageClass& ColorImageClass::prepareForViews(
+     ColorImageClass &parentImg
+     )
+{
+  parentImg.unsharePixels();
+  if (parentImg.pixelHeader != 0)
+  {
+    parentImg.pixelHeader->hasViews = true;
+  }
+
+  return parentImg;
+}
+
+// Assignment takes the size and pixels of "rhsImg", sharing its buffer
+ColorImageClass& ColorImageClass::operator=(
+     const ColorImageClass &rhsImg
+     )
+{
+  if (isView)
+  {
+    // a view keeps its place and size; the pixels are copied into it
+    if (overlapsShifted(rhsImg))
+    {
+      ColorImageClass rhsCopy(rhsImg);
+
+      copyPixels(rhsCopy);
+    }
+    else if (pixelBuffer != rhsImg.pixelBuffer)
+    {
+      copyPixels(rhsImg);
+    }
+  }
+  else if (rhsImg.isView)
+  {
+    // "rhsImg" may be a view into this image's own buffer, so the copy is
+    // made before that buffer is let go
+    ColorImageClass rhsCopy(rhsImg);
+
+    swap(rhsCopy);
+  }
+  else if (this != &rhsImg &&
+           (isSolid || rhsImg.isSolid || pixelBuffer != rhsImg.pixelBuffer))
+  {
+    releasePixels();
+    sharePixels(rhsImg);
+  }
+  markDirty();
+
+  return *this;
+}
+
+#if __cplusplus >= 201103L
+// Move ctor takes the buffer of "rhsImg" and leaves it empty
+ColorImageClass::ColorImageClass(
+     ColorImageClass &&rhsImg
+     ) : isSolid(false), solidEdits(0), numSolidEdits(0), solidEditCapacity(0)
+{
+  pixelBuffer = 0;
+  isView = false;
+  initDirtyTiles();
+  if (rhsImg.isView)
+  {
+    sharePixels(rhsImg);
+    markDirty();
+    return;
+  }
+  rowNum = 0;
+  colNum = 0;
+  rowStride = 0;
+  planeStep = 0;
+  pixelBuffer = 0;
+  pixelHeader = 0;
+  isView = false;
+  allocatorPtr = rhsImg.allocatorPtr;
+  swap(rhsImg);
+}
+
+// Move assignment takes the buffer of "rhsImg" and leaves it empty
+ColorImageClass& ColorImageClass::operator=(
+     ColorImageClass &&rhsImg
+     )
+{
+  if (isView || rhsImg.isView)
+  {
+    return *this = static_cast<const ColorImageClass&>(rhsImg);
+  }
+  if (this != &rhsImg)
+  {
+    releasePixels();
+    rowNum = 0;
+    colNum = 0;
+    rowStride = 0;
+    planeStep = 0;
+    swap(rhsImg);
+  }
+
+  return *this;
+}
+#endif
+
+// Dtor
+ColorImageClass::~ColorImageClass()
+{
+  releasePixels();
+  delete [] solidEdits;
+  delete [] ownDirty.tileStamps;
+}
+
+// Exchange size and pixels with "rhsImg"
+void ColorImageClass::swap(
+     ColorImageClass &rhsImg
+     )
+{
+  int tempVal;
+  size_t tempStep;
+  uint16_t *tempBuffer;
+  PixelHeaderType *tempHeader;
+  PixelAllocatorClass *tempAllocator;
+  bool tempIsView;
+  SolidEditType *tempEdits;
+  DirtyTilesType *tempDirty;
+
+  tempVal = rowNum;
+  rowNum = rhsImg.rowNum;
+  rhsImg.rowNum = tempVal;
+  tempVal = colNum;
+  colNum = rhsImg.colNum;
+  rhsImg.colNum = tempVal;
+  tempVal = rowStride;
+  rowStride = rhsImg.rowStride;
+  rhsImg.rowStride = tempVal;
+  tempStep = planeStep;
+  planeStep = rhsImg.planeStep;
+  rhsImg.planeStep = tempStep;
+  tempBuffer = pixelBuffer;
+  pixelBuffer = rhsImg.pixelBuffer;
+  rhsImg.pixelBuffer = tempBuffer;
+  tempHeader = pixelHeader;
+  pixelHeader = rhsImg.pixelHeader;
+  rhsImg.pixelHeader = tempHeader;
+  tempAllocator = allocatorPtr;
+  allocatorPtr = rhsImg.allocatorPtr;
+  rhsImg.allocatorPtr = tempAllocator;
+  tempIsView = isView;
+  isView = rhsImg.isView;
+  rhsImg.isView = tempIsView;
+  tempIsView = isSolid;
+  isSolid = rhsImg.isSolid;
+  rhsImg.isSolid = tempIsView;
+  for (int c = 0; c < NUM_COLOR_CHANNELS; c++)
+  {
+    uint16_t tempSolidVal = solidVals[c];
+
+    solidVals[c] = rhsImg.solidVals[c];
+    rhsImg.solidVals[c] = tempSolidVal;
+  }
+  tempEdits = solidEdits;
+  solidEdits = rhsImg.solidEdits;
+  rhsImg.solidEdits = tempEdits;
+  tempVal = numSolidEdits;
+  numSolidEdits = rhsImg.numSolidEdits;
+  rhsImg.numSolidEdits = tempVal;
+  tempVal = solidEditCapacity;
+  solidEditCapacity = rhsImg.solidEditCapacity;
+  rhsImg.solidEditCapacity = tempVal;
+
+  // a view takes its place in the outermost image along; an image that
+  // owns its pixels records changes in its own tiles
+  tempDirty = dirtyTiles;
+  dirtyTiles = rhsImg.dirtyTiles;
+  rhsImg.dirtyTiles = tempDirty;
+  tempVal = dirtyOriginRow;
+  dirtyOriginRow = rhsImg.dirtyOriginRow;
+  rhsImg.dirtyOriginRow = tempVal;
+  tempVal = dirtyOriginCol;
+  dirtyOriginCol = rhsImg.dirtyOriginCol;
+  rhsImg.dirtyOriginCol = tempVal;
+  if (!isView)
+  {
+    dirtyTiles = &ownDirty;
+    dirtyOriginRow = 0;
+    dirtyOriginCol = 0;
+  }
+  if (!rhsImg.isView)
+  {
+    rhsImg.dirtyTiles = &rhsImg.ownDirty;
+    rhsImg.dirtyOriginRow = 0;
+    rhsImg.dirtyOriginCol = 0;
+  }
+  markDirty();
+  rhsImg.markDirty();
+}
+
+// Use "inAllocator" for the buffers of images created from now on
+void ColorImageClass::setPixelAllocator(
+     PixelAllocatorClass *inAllocator
+     )
+{
+  currentAllocator = inAllocator;
+}
+
+// Run whole-image operations on "numThreads" threads
+void ColorImageClass::setThreadCount(
+     const int numThreads
+     )
+{
+  imageThreadPool().setThreadCount(numThreads);
+}
+
+// These getter functions simply return the appropriate value
+int ColorImageClass::getRowNum() const
+{
+  return rowNum;
+}
+
+int ColorImageClass::getColNum() const
+{
+  return colNum;
+}
+
+// Band bodies of the whole-image operations
+
+// Zero every plane row, padding included
+bool ColorImageClass::clearRows(
+     const int &,
+     const int firstRow,
+     const int endRow
+     )
+{
+  for (int c = 0; c < NUM_COLOR_CHANNELS; c++)
+  {
+    memset(planeRow(c, firstRow), 0,
+           static_cast<size_t>(endRow - firstRow) * rowStride *
+           sizeof(uint16_t));
+  }
+
+  return false;
+}
+
+bool ColorImageClass::copyRows(
+     const ColorImageClass &rhsImg,
+     const int firstRow,
+     const int endRow
+     )
+{
+  uint16_t rhsVals[ADD_TILE_COLS];
+  int overlapCol = colNum < rhsImg.colNum ? colNum : rhsImg.colNum;
+
+  for (int c = 0; c < NUM_COLOR_CHANNELS; c++)
+  {
+    for (int i = firstRow; i < endRow; i++)
+    {
+      for (int tileCol = 0; tileCol < overlapCol; tileCol += ADD_TILE_COLS)
+      {
+        int numVals = overlapCol - tileCol < ADD_TILE_COLS ?
+                      overlapCol - tileCol : ADD_TILE_COLS;
+
+        memcpy(planeRow(c, i) + tileCol,
+               rhsImg.rowVals(c, i, tileCol, numVals, rhsVals),
+               numVals * sizeof(uint16_t));
+      }
+    }
+  }
+
+  return false;
+}
+
+bool ColorImageClass::fillRows(
+     const ColorClass &inColor,
+     const int firstRow,
+     const int endRow
+     )
+{
+  uint16_t channelVals[NUM_COLOR_CHANNELS];
+
+  colorToVals(inColor, channelVals);
+
+  for (int c = 0; c < NUM_COLOR_CHANNELS; c++)
+  {
+    for (int i = firstRow; i < endRow; i++)
+    {
+      uint16_t *rowPtr = planeRow(c, i);
+
+      for (int j = 0; j < colNum; j++)
+      {
+        rowPtr[j] = channelVals[c];
+      }
+    }
+  }
+
+  return false;
+}
+
+// One tile of a plane row at a time through the row kernel for this CPU;
+// tiles of a solid "rhsImg" are built in "rhsVals"
+bool ColorImageClass::addRows(
+     const ColorImageClass &rhsImg,
+     const int firstRow,
+     const int endRow
+     )
+{
+  AddRowKernelType addRow = getRowKernels().addRow;
+  uint16_t rhsVals[ADD_TILE_COLS];
+  bool flagClip = false;
+  int overlapCol = colNum < rhsImg.colNum ? colNum : rhsImg.colNum;
+
+  for (int c = 0; c < NUM_COLOR_CHANNELS; c++)
+  {
+    for (int i = firstRow; i < endRow; i++)
+    {
+      for (int tileCol = 0; tileCol < overlapCol; tileCol += ADD_TILE_COLS)
+      {
+        int numVals = overlapCol - tileCol < ADD_TILE_COLS ?
+                      overlapCol - tileCol : ADD_TILE_COLS;
+
+        flagClip = addRow(planeRow(c, i) + tileCol,
+                          rhsImg.rowVals(c, i, tileCol, numVals, rhsVals),
+                          numVals) || flagClip;
+      }
+    }
+  }
+
+  return flagClip;
+}
+
+bool ColorImageClass::subtractRows(
+     const ColorImageClass &rhsImg,
+     const int firstRow,
+     const int endRow
+     )
+{
+  AddRowKernelType subtractRow = getRowKernels().subtractRow;
+  uint16_t rhsVals[ADD_TILE_COLS];
+  bool flagClip = false;
+  int overlapCol = colNum < rhsImg.colNum ? colNum : rhsImg.colNum;
+
+  for (int c = 0; c < NUM_COLOR_CHANNELS; c++)
+  {
+    for (int i = firstRow; i < endRow; i++)
+    {
+      for (int tileCol = 0; tileCol < overlapCol; tileCol += ADD_TILE_COLS)
+      {
+        int numVals = overlapCol - tileCol < ADD_TILE_COLS ?
+                      overlapCol - tileCol : ADD_TILE_COLS;
+
+        flagClip = subtractRow(planeRow(c, i) + tileCol,
+                               rhsImg.rowVals(c, i, tileCol, numVals,
+                                              rhsVals),
+                               numVals) || flagClip;
+      }
+    }
+  }
+
+  return flagClip;
+}
+
+bool ColorImageClass::scaleRows(
+     const double &adjFactor,
+     const int firstRow,
+     const int endRow
+     )
+{
+  ScaleRowKernelType scaleRow = getRowKernels().scaleRow;
+  bool flagClip = false;
+
+  for (int c = 0; c < NUM_COLOR_CHANNELS; c++)
+  {
+    for (int i = firstRow; i < endRow; i++)
+    {
+      flagClip = scaleRow(planeRow(c, i), adjFactor, colNum) || flagClip;
+    }
+  }
+
+  return flagClip;
+}
+
+// All inputs are summed tile by tile in 32-bit values and written straight
+// into the object
+bool ColorImageClass::sumRows(
+     const AddImagesArgType &addArgs,
+     const int firstRow,
+     const int endRow
+     )
+{
+  return sumRegion(addArgs, firstRow, endRow, 0, colNum);
+}
+
+// Redo the tiles where an input changed after "compArgs.lastStamp" (all
+// of them if it is 0) and record their clip flags
+bool ColorImageClass::compositeRows(
+     const CompositeArgType &compArgs,
+     const int firstRow,
+     const int endRow
+     )
+{
+  const AddImagesArgType &addArgs = compArgs.addArgs;
+  int numTileCols = (colNum + DIRTY_TILE_COLS - 1) / DIRTY_TILE_COLS;
+
+  for (int ti = firstRow; ti < endRow; ti++)
+  {
+    int tileRow = ti * DIRTY_TILE_ROWS;
+    int tileEndRow = tileRow + DIRTY_TILE_ROWS < rowNum ?
+                     tileRow + DIRTY_TILE_ROWS : rowNum;
+
+    for (int tj = 0; tj < numTileCols; tj++)
+    {
+      int tileCol = tj * DIRTY_TILE_COLS;
+      int tileEndCol = tileCol + DIRTY_TILE_COLS < colNum ?
+                       tileCol + DIRTY_TILE_COLS : colNum;
+      bool isDirty = compArgs.lastStamp == 0;
+
+      for (int k = 0; k < addArgs.numImgsToAdd && !isDirty; k++)
+      {
+        isDirty = addArgs.imagesToAdd[k].regionStamp(
+                       tileRow, tileEndRow, tileCol, tileEndCol) >
+                  compArgs.lastStamp;
+      }
+      if (isDirty)
+      {
+        compArgs.tileClips[ti * numTileCols + tj] =
+             sumRegion(addArgs, tileRow, tileEndRow, tileCol, tileEndCol);
+      }
+    }
+  }
+
+  return false;
+}
+
+bool ColorImageClass::sumRegion(
+     const AddImagesArgType &addArgs,
+     const int firstRow,
+     const int endRow,
+     const int firstCol,
+     const int endCol
+     )
+{
+  uint32_t sumVals[ADD_TILE_COLS];
+  uint16_t srcVals[ADD_TILE_COLS];
+  bool flagClip = false;
+
+  for (int c = 0; c < NUM_COLOR_CHANNELS; c++)
+  {
+    for (int i = firstRow; i < endRow; i++)
+    {
+      uint16_t *dstPtr = planeRow(c, i);
+
+      for (int tileCol = firstCol; tileCol < endCol; tileCol += ADD_TILE_COLS)
+      {
+        int tileEnd = tileCol + ADD_TILE_COLS < endCol ?
+                      tileCol + ADD_TILE_COLS : endCol;
+
+        for (int j = tileCol; j < tileEnd; j++)
+        {
+          sumVals[j - tileCol] = 0;
+        }
+
+        // every input is read for this tile before the tile is written,
+        // so the object may be one of the inputs
+        for (int k = 0; k < addArgs.numImgsToAdd; k++)
+        {
+          const ColorImageClass &srcImg = addArgs.imagesToAdd[k];
+          const uint16_t *srcPtr;
+          int srcEnd;
+
+          if (i >= srcImg.rowNum || tileCol >= srcImg.colNum)
+          {
+            continue;
+          }
+          srcEnd = tileEnd < srcImg.colNum ? tileEnd : srcImg.colNum;
+          srcPtr = srcImg.rowVals(c, i, tileCol, srcEnd - tileCol, srcVals);
+
+          if (addArgs.clipMode == CLIP_EACH_ADD)
+          {
+            for (int j = tileCol; j < srcEnd; j++)
+            {
+              uint32_t sumVal = sumVals[j - tileCol] + srcPtr[j - tileCol];
+
+              flagClip = flagClip || sumVal > MAX_COLOR_VALUE;
+              sumVals[j - tileCol] = sumVal > MAX_COLOR_VALUE ?
+                                     MAX_COLOR_VALUE : sumVal;
+            }
+          }
+          else
+          {
+            for (int j = tileCol; j < srcEnd; j++)
+            {
+              sumVals[j - tileCol] += srcPtr[j - tileCol];
+            }
+          }
+        }
+
+        for (int j = tileCol; j < tileEnd; j++)
+        {
+          uint32_t sumVal = sumVals[j - tileCol];
+
+          if (sumVal > MAX_COLOR_VALUE)
+          {
+            sumVal = MAX_COLOR_VALUE;
+            flagClip = true;
+          }
+          dstPtr[j] = static_cast<uint16_t>(sumVal);
+        }
+      }
+    }
+  }
+
+  return flagClip;
+}
+
+// Postfix steps of the expression over one tile of one plane row at a
+// time. Each stack entry points at the values of its tile: straight into a
+// source image until a step writes to it, then into a scratch row of its
+// own; a solid image's tile is built in that scratch row straight away.
+// Rows and columns outside the result are still worked out where the
+// images reach, as running the steps one by one would.
+bool ColorImageClass::exprRows(
+     const ImageExprClass &inExpr,
+     const int firstRow,
+     const int endRow
+     )
+{
+  const RowKernelsType &rowKernels = getRowKernels();
+  uint16_t scratchVals[MAX_EXPR_NODES][ADD_TILE_COLS];
+  const uint16_t *stackVals[MAX_EXPR_NODES];
+  bool isScratch[MAX_EXPR_NODES];
+  // values of the tile inside the entry's image, 0 if its row is outside
+  int stackNumVals[MAX_EXPR_NODES];
+  bool flagClip = false;
+  int resultRowNum;
+  int resultColNum;
+  int maxRowNum;
+  int maxColNum;
+
+  inExpr.getExtents(resultRowNum, resultColNum, maxRowNum, maxColNum);
+
+  for (int c = 0; c < NUM_COLOR_CHANNELS; c++)
+  {
+    for (int i = firstRow; i < endRow; i++)
+    {
+      for (int tileCol = 0; tileCol < maxColNum; tileCol += ADD_TILE_COLS)
+      {
+        int tileEnd = tileCol + ADD_TILE_COLS < maxColNum ?
+                      tileCol + ADD_TILE_COLS : maxColNum;
+        int numEntries = 0;
+
+        for (int n = 0; n < inExpr.numNodes; n++)
+        {
+          const ImageExprClass::ExprNodeType &exprNode = inExpr.exprNodes[n];
+          int topIdx;
+          int numVals;
+
+          if (exprNode.opType == EXPR_IMAGE)
+          {
+            const ColorImageClass &srcImg = *exprNode.imgPtr;
+
+            topIdx = numEntries++;
+            numVals = 0;
+            if (i < srcImg.rowNum && tileCol < srcImg.colNum)
+            {
+              numVals = (tileEnd < srcImg.colNum ? tileEnd : srcImg.colNum) -
+                        tileCol;
+              stackVals[topIdx] = srcImg.rowVals(c, i, tileCol, numVals,
+                                                 scratchVals[topIdx]);
+            }
+            stackNumVals[topIdx] = numVals;
+            isScratch[topIdx] = stackVals[topIdx] == scratchVals[topIdx];
+            continue;
+          }
+
+          // the step writes into the entry below the operands
+          topIdx = exprNode.opType == EXPR_SCALE ? numEntries - 1 :
+                                                   numEntries - 2;
+          numVals = stackNumVals[topIdx];
+          if (exprNode.opType != EXPR_SCALE)
+          {
+            numVals = numVals < stackNumVals[topIdx + 1] ?
+                      numVals : stackNumVals[topIdx + 1];
+            numEntries--;
+          }
+          if (numVals == 0)
+          {
+            continue;
+          }
+          if (!isScratch[topIdx])
+          {
+            memcpy(scratchVals[topIdx], stackVals[topIdx],
+                   stackNumVals[topIdx] * sizeof(uint16_t));
+            stackVals[topIdx] = scratchVals[topIdx];
+            isScratch[topIdx] = true;
+          }
+
+          if (exprNode.opType == EXPR_ADD)
+          {
+            flagClip = rowKernels.addRow(scratchVals[topIdx],
+                                         stackVals[topIdx + 1], numVals) ||
+                       flagClip;
+          }
+          else if (exprNode.opType == EXPR_SUBTRACT)
+          {
+            flagClip = rowKernels.subtractRow(scratchVals[topIdx],
+                                              stackVals[topIdx + 1],
+                                              numVals) || flagClip;
+          }
+          else
+          {
+            flagClip = rowKernels.scaleRow(scratchVals[topIdx],
+                                           exprNode.adjFactor, numVals) ||
+                       flagClip;
+          }
+        }
+
+        // every image is read for this tile before it is written, so the
+        // object may be one of them
+        if (i < rowNum && stackNumVals[0] > 0 &&
+            stackVals[0] != planeRow(c, i) + tileCol)
+        {
+          memcpy(planeRow(c, i) + tileCol, stackVals[0],
+                 stackNumVals[0] * sizeof(uint16_t));
+        }
+      }
+    }
+  }
+
+  return flagClip;
+}
+
+// Convert PPM samples (interleaved, big-endian when two bytes) into the
+// planes through the sample value table
+bool ColorImageClass::ppmRows(
+     const PpmRowsArgType &ppmArgs,
+     const int firstRow,
+     const int endRow
+     )
+{
+  const uint16_t *valTable = ppmArgs.valTable;
+
+  for (int i = firstRow; i < endRow; i++)
+  {
+    const unsigned char *srcPtr = ppmArgs.dataPtr + i * ppmArgs.rowBytes;
+    uint16_t *redPtr = planeRow(CHANNEL_RED, i);
+    uint16_t *greenPtr = planeRow(CHANNEL_GREEN, i);
+    uint16_t *bluePtr = planeRow(CHANNEL_BLUE, i);
+
+    if (ppmArgs.numChannels == NUM_COLOR_CHANNELS && ppmArgs.bytesPerVal == 2)
+    {
+      for (int j = 0; j < colNum; j++)
+      {
+        redPtr[j] = valTable[srcPtr[0] << 8 | srcPtr[1]];
+        greenPtr[j] = valTable[srcPtr[2] << 8 | srcPtr[3]];
+        bluePtr[j] = valTable[srcPtr[4] << 8 | srcPtr[5]];
+        srcPtr += 6;
+      }
+    }
+    else if (ppmArgs.numChannels == NUM_COLOR_CHANNELS)
+    {
+      for (int j = 0; j < colNum; j++)
+      {
+        redPtr[j] = valTable[srcPtr[0]];
+        greenPtr[j] = valTable[srcPtr[1]];
+        bluePtr[j] = valTable[srcPtr[2]];
+        srcPtr += 3;
+      }
+    }
+    else
+    {
+      for (int j = 0; j < colNum; j++)
+      {
+        int sampleVal = ppmArgs.bytesPerVal == 2 ? srcPtr[0] << 8 | srcPtr[1] :
+                                                   srcPtr[0];
+
+        redPtr[j] = valTable[sampleVal];
+        greenPtr[j] = redPtr[j];
+        bluePtr[j] = redPtr[j];
+        srcPtr += ppmArgs.bytesPerVal;
+      }
+    }
+  }
+
+  return false;
+}
+
+// Initial all pixels to the color provided 
+void ColorImageClass::initializeTo(
+     const ColorClass &inColor
+     )
+{
+  ImageRowsTaskClass<ColorClass> fillTask(this, &ColorImageClass::fillRows,
+                                          inColor);
+
+  markDirty();
+  if (canBeSolid())
+  {
+    uint16_t inVals[NUM_COLOR_CHANNELS];
+
+    colorToVals(inColor, inVals);
+    makeSolid(rowNum, colNum, inVals);
+    return;
+  }
+  preparePixels(rowNum, colNum);
+  runRowBands(fillTask, rowNum, rowStride);
+}    
+
+// Add image to object. Return true if require clipping.
+bool ColorImageClass::addImageTo(
+     const ColorImageClass &rhsImg
+     )
+{
+  markDirty();
+  if (canCombineSolid(rhsImg))
+  {
+    return combineSolid(rhsImg, EXPR_ADD);
+  }
+  if (overlapsShifted(rhsImg))
+  {
+    // another part of the same buffer; work from a copy of it
+    ColorImageClass rhsCopy(rhsImg);
+
+    return addImageTo(rhsCopy);
+  }
+
+  ImageRowsTaskClass<ColorImageClass> addTask(this, &ColorImageClass::addRows,
+                                              rhsImg);
+  int overlapRow = rowNum < rhsImg.rowNum ? rowNum : rhsImg.rowNum;
+
+  unsharePixels();
+  return runRowBands(addTask, overlapRow, rowStride);
+}     
+
+// Subtract image from object. Return true if require clipping.
+bool ColorImageClass::subtractImage(
+     const ColorImageClass &rhsImg
+     )
+{
+  markDirty();
+  if (canCombineSolid(rhsImg))
+  {
+    return combineSolid(rhsImg, EXPR_SUBTRACT);
+  }
+  if (overlapsShifted(rhsImg))
+  {
+    ColorImageClass rhsCopy(rhsImg);
+
+    return subtractImage(rhsCopy);
+  }
+
+  ImageRowsTaskClass<ColorImageClass> subtractTask(
+       this, &ColorImageClass::subtractRows, rhsImg);
+  int overlapRow = rowNum < rhsImg.rowNum ? rowNum : rhsImg.rowNum;
+
+  unsharePixels();
+  return runRowBands(subtractTask, overlapRow, rowStride);
+}
+
+// Adjust the brightness of every pixel. Return true if require clipping.
+bool ColorImageClass::adjustBrightness(
+     const double adjFactor
+     )
+{
+  ImageRowsTaskClass<double> scaleTask(this, &ColorImageClass::scaleRows,
+                                       adjFactor);
+
+  markDirty();
+  if (isSolid)
+  {
+    // scale the solid color and each edit; edits that end up the same as
+    // the solid color are dropped
+    bool solidClip = scaleRowScalar(solidVals, adjFactor, NUM_COLOR_CHANNELS);
+    bool flagClip = false;
+    int numKept = 0;
+
+    for (int n = 0; n < numSolidEdits; n++)
+    {
+      flagClip = scaleRowScalar(solidEdits[n].colorVals, adjFactor,
+                                NUM_COLOR_CHANNELS) || flagClip;
+      if (memcmp(solidEdits[n].colorVals, solidVals, sizeof(solidVals)) != 0)
+      {
+        solidEdits[numKept++] = solidEdits[n];
+      }
+    }
+    flagClip = flagClip ||
+               (solidClip && static_cast<size_t>(numSolidEdits) <
+                             static_cast<size_t>(rowNum) * colNum);
+    numSolidEdits = numKept;
+    return flagClip;
+  }
+  unsharePixels();
+  return runRowBands(scaleTask, rowNum, rowStride);
+}
+
+// Add images and assign object to the result.
+// Return true if require clipping.
+bool ColorImageClass::addImages(
+     const int numImgsToAdd,
+     const ColorImageClass imagesToAdd[],
+     const int clipMode
+     )
+{
+  AddImagesArgType addArgs;
+
+  markDirty();
+  if (canSumSolid(numImgsToAdd, imagesToAdd))
   {
-    for (int j = 0; j < colNum; j++)
+    // colors are never negative, so adding the inputs one at a time gives
+    // the same pixels and clip flag, and keeps the sum solid
+    ColorImageClass sumImg(rowNum, colNum);
+    bool flagClip = false;
+
+    for (int k = 0; k < numImgsToAdd; k++)
     {
-      pixelArrary[i][j].setTo(sumImg.pixelArrary[i][j]);
+      flagClip = sumImg.addImageTo(imagesToAdd[k]) || flagClip;
     }
+    swap(sumImg);
+    return flagClip;
   }
 
-  return flagClip;
+  for (int k = 0; k < numImgsToAdd; k++)
+  {
+    if (overlapsShifted(imagesToAdd[k]))
+    {
+      // an input is another part of the same buffer; sum into a new image
+      ColorImageClass resultImg(rowNum, colNum);
+      bool flagClip = resultImg.addImages(numImgsToAdd, imagesToAdd,
+                                          clipMode);
+
+      *this = resultImg;
+      return flagClip;
+    }
+  }
+
+  addArgs.numImgsToAdd = numImgsToAdd;
+  addArgs.imagesToAdd = imagesToAdd;
+  addArgs.clipMode = clipMode;
+  ImageRowsTaskClass<AddImagesArgType> sumTask(
+       this, &ColorImageClass::sumRows, addArgs);
+
+  // a copy, not a fresh buffer: the object may be one of the inputs
+  unsharePixels();
+  return runRowBands(sumTask, rowNum, rowStride);
 }     
 
+// Assign object to the result of "inExpr".
+// Return true if require clipping.
+bool ColorImageClass::assignExpr(
+     const ImageExprClass &inExpr
+     )
+{
+  int resultRowNum;
+  int resultColNum;
+  int maxRowNum;
+  int maxColNum;
+
+  markDirty();
+  inExpr.getExtents(resultRowNum, resultColNum, maxRowNum, maxColNum);
+  bool isShifted = false;
+  bool isAllSolid = canBeSolid();
+
+  for (int n = 0; n < inExpr.numNodes; n++)
+  {
+    isShifted = isShifted ||
+                (inExpr.exprNodes[n].opType == EXPR_IMAGE &&
+                 overlapsShifted(*inExpr.exprNodes[n].imgPtr));
+    isAllSolid = isAllSolid &&
+                 (inExpr.exprNodes[n].opType != EXPR_IMAGE ||
+                  inExpr.exprNodes[n].imgPtr->isSolid);
+  }
+  if (isAllSolid)
+  {
+    // run the steps one by one on solid copies, which only works out the
+    // solid colors and the edits
+    ColorImageClass stackImgs[MAX_EXPR_NODES];
+    bool flagClip = false;
+    int numEntries = 0;
+
+    for (int n = 0; n < inExpr.numNodes; n++)
+    {
+      const ImageExprClass::ExprNodeType &exprNode = inExpr.exprNodes[n];
+
+      if (exprNode.opType == EXPR_IMAGE)
+      {
+        stackImgs[numEntries++] = *exprNode.imgPtr;
+      }
+      else if (exprNode.opType == EXPR_SCALE)
+      {
+        flagClip = stackImgs[numEntries - 1].adjustBrightness(
+                        exprNode.adjFactor) || flagClip;
+      }
+      else
+      {
+        numEntries--;
+        flagClip = (exprNode.opType == EXPR_ADD ?
+                    stackImgs[numEntries - 1].addImageTo(
+                         stackImgs[numEntries]) :
+                    stackImgs[numEntries - 1].subtractImage(
+                         stackImgs[numEntries])) || flagClip;
+      }
+    }
+    swap(stackImgs[0]);
+    return flagClip;
+  }
+  if (resultRowNum != rowNum || resultColNum != colNum || isShifted)
+  {
+    // the object may be one of the images, so it keeps its pixels until
+    // the result is done. A view keeps its size and takes the overlap.
+    ColorImageClass resultImg(resultRowNum, resultColNum);
+    bool flagClip = resultImg.assignExpr(inExpr);
+
+    *this = resultImg;
+    return flagClip;
+  }
+
+  ImageRowsTaskClass<ImageExprClass> exprTask(
+       this, &ColorImageClass::exprRows, inExpr);
+
+  unsharePixels();
+  return runRowBands(exprTask, maxRowNum, rowStride);
+}
+
+// Bring the first "numRows" rows of PPM samples into the image
+void ColorImageClass::importPpmRows(
+     const PpmRowsArgType &ppmArgs,
+     const int numRows
+     )
+{
+  ImageRowsTaskClass<PpmRowsArgType> ppmTask(
+       this, &ColorImageClass::ppmRows, ppmArgs);
+
+  runRowBands(ppmTask, numRows, rowStride);
+}
+
+// Load a binary PPM (P6) or PGM (P5) file and return true
+bool ColorImageClass::readPpm(
+     const char *fileName
+     )
+{
+  MappedFileClass ppmFile(fileName);
+  PpmHeaderType ppmHeader;
+  PpmRowsArgType ppmArgs;
+  uint16_t *valTable;
+
+  if (!ppmFile.isOpen() ||
+      !parsePpmHeader(ppmFile.getData(), ppmFile.getSize(), ppmHeader) ||
+      !ppmDataFits(ppmHeader, ppmFile.getSize()))
+  {
+    return false;
+  }
+  if (isView && (ppmHeader.rowNum != rowNum || ppmHeader.colNum != colNum))
+  {
+    return false;
+  }
+
+  preparePixels(ppmHeader.rowNum, ppmHeader.colNum);
+  markDirty();
+  valTable = makePpmValTable(ppmHeader);
+
+  ppmArgs.dataPtr = ppmFile.getData() + ppmHeader.dataOffset;
+  ppmArgs.rowBytes = ppmRowBytes(ppmHeader);
+  ppmArgs.numChannels = ppmHeader.numChannels;
+  ppmArgs.bytesPerVal = ppmHeader.bytesPerVal;
+  ppmArgs.valTable = valTable;
+  importPpmRows(ppmArgs, rowNum);
+
+  delete [] valTable;
+
+  return true;
+}
+
+// Save the image as a binary PPM (P6) file. Rows are converted into one
+// buffer and written whenever it is full, so the file goes out in a few
+// large writes.
+bool ColorImageClass::writePpm(
+     const char *fileName,
+     const int outMaxVal
+     ) const
+{
+  uint16_t outTable[MAX_COLOR_VALUE + 1];
+  size_t rowBytes;
+  size_t bufferSize;
+  size_t usedBytes;
+  unsigned char *bufferPtr;
+  FILE *outFile;
+  bool isWritten;
+  int bytesPerVal;
+
+  if (isSolid)
+  {
+    // the rows are written from planes
+    ColorImageClass denseImg(*this);
+
+    denseImg.densifyPixels();
+    return denseImg.writePpm(fileName, outMaxVal);
+  }
+  if (outMaxVal < 1 || outMaxVal > PPM_MAX_VAL)
+  {
+    return false;
+  }
+  outFile = fopen(fileName, "wb");
+  if (outFile == 0)
+  {
+    return false;
+  }
+
+  for (int v = MIN_COLOR_VALUE; v <= MAX_COLOR_VALUE; v++)
+  {
+    outTable[v] = static_cast<uint16_t>(
+         (static_cast<long>(v) * outMaxVal + MAX_COLOR_VALUE / 2) /
+         MAX_COLOR_VALUE);
+  }
+  bytesPerVal = outMaxVal > 255 ? 2 : 1;
+  rowBytes = static_cast<size_t>(colNum) * NUM_COLOR_CHANNELS * bytesPerVal;
+  bufferSize = rowBytes > IMAGE_IO_BUFFER_BYTES ? rowBytes :
+                                                  IMAGE_IO_BUFFER_BYTES;
+  bufferPtr = new unsigned char[bufferSize];
+
+  usedBytes = sprintf(reinterpret_cast<char*>(bufferPtr), "P6\n%d %d\n%d\n",
+                      colNum, rowNum, outMaxVal);
+  isWritten = true;
+  for (int i = 0; i < rowNum && isWritten; i++)
+  {
+    const uint16_t *redPtr = planeRow(CHANNEL_RED, i);
+    const uint16_t *greenPtr = planeRow(CHANNEL_GREEN, i);
+    const uint16_t *bluePtr = planeRow(CHANNEL_BLUE, i);
+    unsigned char *dstPtr;
+
+    if (usedBytes + rowBytes > bufferSize)
+    {
+      isWritten = fwrite(bufferPtr, 1, usedBytes, outFile) == usedBytes;
+      usedBytes = 0;
+    }
+    dstPtr = bufferPtr + usedBytes;
+    if (bytesPerVal == 2)
+    {
+      // samples are big-endian
+      for (int j = 0; j < colNum; j++)
+      {
+        uint16_t redVal = outTable[redPtr[j]];
+        uint16_t greenVal = outTable[greenPtr[j]];
+        uint16_t blueVal = outTable[bluePtr[j]];
+
+        dstPtr[0] = static_cast<unsigned char>(redVal >> 8);
+        dstPtr[1] = static_cast<unsigned char>(redVal);
+        dstPtr[2] = static_cast<unsigned char>(greenVal >> 8);
+        dstPtr[3] = static_cast<unsigned char>(greenVal);
+        dstPtr[4] = static_cast<unsigned char>(blueVal >> 8);
+        dstPtr[5] = static_cast<unsigned char>(blueVal);
+        dstPtr += 6;
+      }
+    }
+    else
+    {
+      for (int j = 0; j < colNum; j++)
+      {
+        dstPtr[0] = static_cast<unsigned char>(outTable[redPtr[j]]);
+        dstPtr[1] = static_cast<unsigned char>(outTable[greenPtr[j]]);
+        dstPtr[2] = static_cast<unsigned char>(outTable[bluePtr[j]]);
+        dstPtr += 3;
+      }
+    }
+    usedBytes += rowBytes;
+  }
+  if (isWritten && usedBytes > 0)
+  {
+    isWritten = fwrite(bufferPtr, 1, usedBytes, outFile) == usedBytes;
+  }
+  delete [] bufferPtr;
+
+  // a failed close can mean buffered bytes never reached the file
+  return fclose(outFile) == 0 && isWritten;
+}
+
 // Set pixels at the "inRowCol" location to the "inColor".
 // If the location is valid, return true.
 // Else, image is not modified and return false.
@@ -651,7 +4647,21 @@ bool ColorImageClass::setColorAtLocation(
   if (rowLoc >= lowerBound && rowLoc < rowNum &&
       colLoc >= lowerBound && colLoc < colNum)
   {
-    pixelArrary[rowLoc][colLoc].setTo(inColor); 
+    uint16_t inVals[NUM_COLOR_CHANNELS];
+
+    colorToVals(inColor, inVals);
+    markDirtyRegion(nextDirtyStamp(), rowLoc, rowLoc + 1, colLoc, colLoc + 1);
+    if (isSolid && setSolidEdit(solidPixelIdx(rowLoc, colLoc), inVals))
+    {
+      return true;
+    }
+    unsharePixels();
+    planeRow(CHANNEL_RED, rowLoc)[colLoc] =
+         static_cast<uint16_t>(inColor.getRed());
+    planeRow(CHANNEL_GREEN, rowLoc)[colLoc] =
+         static_cast<uint16_t>(inColor.getGreen());
+    planeRow(CHANNEL_BLUE, rowLoc)[colLoc] =
+         static_cast<uint16_t>(inColor.getBlue());
     return true;
   }
   else
@@ -676,7 +4686,17 @@ bool ColorImageClass::getColorAtLocation(
   if (rowLoc >= lowerBound && rowLoc < rowNum &&
       colLoc >= lowerBound && colLoc < colNum)
   {
-    outColor.setTo(pixelArrary[rowLoc][colLoc]);
+    if (isSolid)
+    {
+      const uint16_t *pixelVals = solidPixel(solidPixelIdx(rowLoc, colLoc));
+
+      outColor.setTo(pixelVals[CHANNEL_RED], pixelVals[CHANNEL_GREEN],
+                     pixelVals[CHANNEL_BLUE]);
+      return true;
+    }
+    outColor.setTo(planeRow(CHANNEL_RED, rowLoc)[colLoc],
+                   planeRow(CHANNEL_GREEN, rowLoc)[colLoc],
+                   planeRow(CHANNEL_BLUE, rowLoc)[colLoc]);
     return true;
   }    
   else
@@ -685,21 +4705,462 @@ bool ColorImageClass::getColorAtLocation(
   }
 }     
 
-// Print the contents of the image.
+// Fill "outValidBits" for the locations and return how many are valid
+int ColorImageClass::checkLocations(
+     const int numPoints,
+     const RowColumnClass inRowCols[],
+     uint32_t outValidBits[]
+     ) const
+{
+  CheckPointsKernelType checkPoints = getRowKernels().checkPoints;
+  int numValid = 0;
+
+  for (int k = 0; k < numPoints; k += 32)
+  {
+    int wordPoints = numPoints - k < 32 ? numPoints - k : 32;
+    uint32_t validBits = checkPoints(inRowCols + k, wordPoints, rowNum,
+                                     colNum);
+
+    outValidBits[k / 32] = validBits;
+    for (; validBits != 0; validBits &= validBits - 1)
+    {
+      numValid++;
+    }
+  }
+
+  return numValid;
+}
+
+// Batched "setColorAtLocation". Return true if every location is valid.
+bool ColorImageClass::setColorsAtLocations(
+     const int numPoints,
+     const RowColumnClass inRowCols[],
+     const ColorClass inColors[],
+     uint32_t outValidBits[]
+     )
+{
+  int numValid = checkLocations(numPoints, inRowCols, outValidBits);
+  uint64_t dirtyStamp;
+  int *pointOrder;
+  int *rowStart;
+
+  if (numValid == 0)
+  {
+    return numPoints == 0;
+  }
+  dirtyStamp = nextDirtyStamp();
+  for (int k = 0; k < numPoints; k++)
+  {
+    if ((outValidBits[k / 32] >> (k % 32)) & 1)
+    {
+      int rowLoc = inRowCols[k].getRow();
+      int colLoc = inRowCols[k].getCol();
+
+      markDirtyRegion(dirtyStamp, rowLoc, rowLoc + 1, colLoc, colLoc + 1);
+    }
+  }
+  if (isSolid && numSolidEdits + numValid <= maxSolidEdits())
+  {
+    for (int k = 0; k < numPoints; k++)
+    {
+      if ((outValidBits[k / 32] >> (k % 32)) & 1)
+      {
+        uint16_t inVals[NUM_COLOR_CHANNELS];
+
+        colorToVals(inColors[k], inVals);
+        setSolidEdit(solidPixelIdx(inRowCols[k].getRow(),
+                                   inRowCols[k].getCol()),
+                     inVals);
+      }
+    }
+    return numValid == numPoints;
+  }
+  unsharePixels();
+
+  if (numValid < BATCH_BUCKET_MIN_POINTS || numValid < rowNum)
+  {
+    for (int k = 0; k < numPoints; k++)
+    {
+      if ((outValidBits[k / 32] >> (k % 32)) & 1)
+      {
+        int rowLoc = inRowCols[k].getRow();
+        int colLoc = inRowCols[k].getCol();
+
+        planeRow(CHANNEL_RED, rowLoc)[colLoc] =
+             static_cast<uint16_t>(inColors[k].getRed());
+        planeRow(CHANNEL_GREEN, rowLoc)[colLoc] =
+             static_cast<uint16_t>(inColors[k].getGreen());
+        planeRow(CHANNEL_BLUE, rowLoc)[colLoc] =
+             static_cast<uint16_t>(inColors[k].getBlue());
+      }
+    }
+    return numValid == numPoints;
+  }
+
+  // bucket the valid points by row with a counting sort; it is stable, so
+  // repeated locations are still written in the order given
+  rowStart = new int[rowNum + 1];
+  pointOrder = new int[numValid];
+  memset(rowStart, 0, (rowNum + 1) * sizeof(int));
+  for (int k = 0; k < numPoints; k++)
+  {
+    if ((outValidBits[k / 32] >> (k % 32)) & 1)
+    {
+      rowStart[inRowCols[k].getRow() + 1]++;
+    }
+  }
+  for (int i = 0; i < rowNum; i++)
+  {
+    rowStart[i + 1] += rowStart[i];
+  }
+  for (int k = 0; k < numPoints; k++)
+  {
+    if ((outValidBits[k / 32] >> (k % 32)) & 1)
+    {
+      pointOrder[rowStart[inRowCols[k].getRow()]++] = k;
+    }
+  }
+
+  for (int n = 0; n < numValid; n++)
+  {
+    int k = pointOrder[n];
+    int rowLoc = inRowCols[k].getRow();
+    int colLoc = inRowCols[k].getCol();
+
+    planeRow(CHANNEL_RED, rowLoc)[colLoc] =
+         static_cast<uint16_t>(inColors[k].getRed());
+    planeRow(CHANNEL_GREEN, rowLoc)[colLoc] =
+         static_cast<uint16_t>(inColors[k].getGreen());
+    planeRow(CHANNEL_BLUE, rowLoc)[colLoc] =
+         static_cast<uint16_t>(inColors[k].getBlue());
+  }
+
+  delete [] pointOrder;
+  delete [] rowStart;
+
+  return numValid == numPoints;
+}
+
+// Batched "getColorAtLocation". Return true if every location is valid.
+bool ColorImageClass::getColorsAtLocations(
+     const int numPoints,
+     const RowColumnClass inRowCols[],
+     ColorClass outColors[],
+     uint32_t outValidBits[]
+     ) const
+{
+  int numValid = checkLocations(numPoints, inRowCols, outValidBits);
+
+  for (int k = 0; k < numPoints; k++)
+  {
+    if ((outValidBits[k / 32] >> (k % 32)) & 1)
+    {
+      int rowLoc = inRowCols[k].getRow();
+      int colLoc = inRowCols[k].getCol();
+
+      if (isSolid)
+      {
+        const uint16_t *pixelVals = solidPixel(solidPixelIdx(rowLoc, colLoc));
+
+        outColors[k].setTo(pixelVals[CHANNEL_RED], pixelVals[CHANNEL_GREEN],
+                           pixelVals[CHANNEL_BLUE]);
+        continue;
+      }
+      outColors[k].setTo(planeRow(CHANNEL_RED, rowLoc)[colLoc],
+                         planeRow(CHANNEL_GREEN, rowLoc)[colLoc],
+                         planeRow(CHANNEL_BLUE, rowLoc)[colLoc]);
+    }
+  }
+
+  return numValid == numPoints;
+}
+
+// Print the contents of the image. The text is formatted into one buffer
+// and written whenever it fills, instead of several "cout <<" per pixel;
+// the output is the same as printing every pixel with
+// "ColorClass::printComponentValues".
 void ColorImageClass::printImage() const
 {
   int stopDashCol = colNum - 1;
+  size_t rowChars = static_cast<size_t>(colNum) * MAX_PIXEL_TEXT_CHARS + 1;
+  size_t bufferSize = rowChars > IMAGE_IO_BUFFER_BYTES ? rowChars :
+                                                         IMAGE_IO_BUFFER_BYTES;
+  char *bufferPtr;
+  char *dstPtr;
+
+  if (isSolid)
+  {
+    // the text is formatted from planes
+    ColorImageClass denseImg(*this);
+
+    denseImg.densifyPixels();
+    denseImg.printImage();
+    return;
+  }
+  bufferPtr = new char[bufferSize];
+  dstPtr = bufferPtr;
   
   for (int i = 0; i < rowNum; i++)
   {
+    const uint16_t *redPtr = planeRow(CHANNEL_RED, i);
+    const uint16_t *greenPtr = planeRow(CHANNEL_GREEN, i);
+    const uint16_t *bluePtr = planeRow(CHANNEL_BLUE, i);
+
+    if (static_cast<size_t>(dstPtr - bufferPtr) + rowChars > bufferSize)
+    {
+      cout.write(bufferPtr, dstPtr - bufferPtr);
+      dstPtr = bufferPtr;
+    }
     for (int j = 0; j < stopDashCol; j++)
     {
-      pixelArrary[i][j].printComponentValues();
-      cout << "--";
+      dstPtr = appendPixelText(dstPtr, redPtr[j], greenPtr[j], bluePtr[j]);
+      dstPtr[0] = '-';
+      dstPtr[1] = '-';
+      dstPtr += 2;
+    }
+    dstPtr = appendPixelText(dstPtr, redPtr[stopDashCol],
+                             greenPtr[stopDashCol], bluePtr[stopDashCol]);
+    *dstPtr++ = '\n';
+  }
+  cout.write(bufferPtr, dstPtr - bufferPtr);
+  cout.flush();
+
+  delete [] bufferPtr;
+}
+
+// ===== ImageViewClass Member Function =====
+
+// Ctor
+// View of a rectangle of "parentImg"
+ImageViewClass::ImageViewClass(
+     ColorImageClass &parentImg,
+     const RowColumnClass &originRowCol,
+     const int inRowNum,
+     const int inColNum
+     ) : ColorImageClass(prepareForViews(parentImg), originRowCol, inRowNum,
+                         inColNum)
+{
+}
+
+// Copy ctor views the same pixels as "rhsView"
+ImageViewClass::ImageViewClass(
+     const ImageViewClass &rhsView
+     ) : ColorImageClass(rhsView, RowColumnClass(0, 0), rhsView.getRowNum(),
+                         rhsView.getColNum())
+{
+}
+
+// Copy "rhsImg" into the viewed pixels where they overlap
+ImageViewClass& ImageViewClass::operator=(
+     const ColorImageClass &rhsImg
+     )
+{
+  ColorImageClass::operator=(rhsImg);
+
+  return *this;
+}
+
+ImageViewClass& ImageViewClass::operator=(
+     const ImageViewClass &rhsView
+     )
+{
+  ColorImageClass::operator=(rhsView);
+
+  return *this;
+}
+
+// ===== ImageCompositorClass Member Function =====
+
+// Ctor
+// Sum of "imagesToAdd" into an "inRowNum" x "inColNum" image
+ImageCompositorClass::ImageCompositorClass(
+     const int numImgsToAdd,
+     const ColorImageClass imagesToAdd[],
+     const int inRowNum,
+     const int inColNum,
+     const int clipMode
+     ) : sumImg(inRowNum, inColNum)
+{
+  int numTileRows = (sumImg.getRowNum() + DIRTY_TILE_ROWS - 1) /
+                    DIRTY_TILE_ROWS;
+  int numTileCols = (sumImg.getColNum() + DIRTY_TILE_COLS - 1) /
+                    DIRTY_TILE_COLS;
+
+  addArgs.numImgsToAdd = numImgsToAdd;
+  addArgs.imagesToAdd = imagesToAdd;
+  addArgs.clipMode = clipMode;
+  compositeStamp = 0;
+  numTiles = numTileRows * numTileCols;
+  tileClips = new bool[numTiles];
+  memset(tileClips, 0, numTiles * sizeof(bool));
+}
+
+// Dtor
+ImageCompositorClass::~ImageCompositorClass()
+{
+  delete [] tileClips;
+}
+
+// Bring the sum up to date with the inputs. Only tiles where an input
+// changed since the last call are added up again, in bands of tile rows
+// on the thread pool; the clip flag comes from the flags of all tiles.
+bool ImageCompositorClass::composite()
+{
+  CompositeArgType compArgs;
+  uint64_t newStamp = nextDirtyStamp();
+  bool flagClip = false;
+
+  if (sumImg.canSumSolid(addArgs.numImgsToAdd, addArgs.imagesToAdd))
+  {
+    // the sum stays solid, and only the edits are added up
+    compositeStamp = 0;
+    return sumImg.addImages(addArgs.numImgsToAdd, addArgs.imagesToAdd,
+                            addArgs.clipMode);
+  }
+  if (sumImg.isSolid)
+  {
+    compositeStamp = 0;
+  }
+  // planes of its own to write the tiles into; a copy of the sum handed
+  // out by "getSum" keeps the old pixels
+  sumImg.unsharePixels();
+
+  compArgs.addArgs = addArgs;
+  compArgs.lastStamp = compositeStamp;
+  compArgs.tileClips = tileClips;
+  ImageRowsTaskClass<CompositeArgType> compositeTask(
+       &sumImg, &ColorImageClass::compositeRows, compArgs);
+  runRowBands(compositeTask, (sumImg.rowNum + DIRTY_TILE_ROWS - 1) /
+                             DIRTY_TILE_ROWS,
+              sumImg.rowStride * DIRTY_TILE_ROWS);
+  compositeStamp = newStamp;
+
+  for (int t = 0; t < numTiles; t++)
+  {
+    flagClip = flagClip || tileClips[t];
+  }
+
+  return flagClip;
+}
+
+// The sum as of the last "composite"
+const ColorImageClass& ImageCompositorClass::getSum() const
+{
+  return sumImg;
+}
+
+// ===== ImageExprClass Member Function =====
+
+// Ctor
+// An expression of just "inImg"
+ImageExprClass::ImageExprClass(
+     const ColorImageClass &inImg
+     )
+{
+  numNodes = 1;
+  exprNodes[0].opType = EXPR_IMAGE;
+  exprNodes[0].imgPtr = &inImg;
+  exprNodes[0].adjFactor = 1.0;
+}
+
+// Append the steps of "inExpr"
+void ImageExprClass::appendNodes(
+     const ImageExprClass &inExpr
+     )
+{
+  if (numNodes + inExpr.numNodes > MAX_EXPR_NODES)
+  {
+    throw length_error("image expression has too many steps");
+  }
+  for (int n = 0; n < inExpr.numNodes; n++)
+  {
+    exprNodes[numNodes++] = inExpr.exprNodes[n];
+  }
+}
+
+void ImageExprClass::appendNode(
+     const int opType,
+     const double adjFactor
+     )
+{
+  if (numNodes >= MAX_EXPR_NODES)
+  {
+    throw length_error("image expression has too many steps");
+  }
+  exprNodes[numNodes].opType = opType;
+  exprNodes[numNodes].imgPtr = 0;
+  exprNodes[numNodes].adjFactor = adjFactor;
+  numNodes++;
+}
+
+// Size of the result and the largest size of any image in the expression
+void ImageExprClass::getExtents(
+     int &outRowNum,
+     int &outColNum,
+     int &outMaxRowNum,
+     int &outMaxColNum
+     ) const
+{
+  // the result is the first image with the rest applied to it
+  outRowNum = exprNodes[0].imgPtr->getRowNum();
+  outColNum = exprNodes[0].imgPtr->getColNum();
+  outMaxRowNum = 0;
+  outMaxColNum = 0;
+  for (int n = 0; n < numNodes; n++)
+  {
+    if (exprNodes[n].opType == EXPR_IMAGE)
+    {
+      const ColorImageClass &srcImg = *exprNodes[n].imgPtr;
+
+      if (srcImg.getRowNum() > outMaxRowNum)
+      {
+        outMaxRowNum = srcImg.getRowNum();
+      }
+      if (srcImg.getColNum() > outMaxColNum)
+      {
+        outMaxColNum = srcImg.getColNum();
+      }
     }
-    pixelArrary[i][stopDashCol].printComponentValues();
-    cout << endl;
   }
 }
 
+// Record "lhsExpr" plus "rhsExpr"
+ImageExprClass operator+(
+     const ImageExprClass &lhsExpr,
+     const ImageExprClass &rhsExpr
+     )
+{
+  ImageExprClass resultExpr(lhsExpr);
+
+  resultExpr.appendNodes(rhsExpr);
+  resultExpr.appendNode(EXPR_ADD, 1.0);
+
+  return resultExpr;
+}
+
+// Record "lhsExpr" minus "rhsExpr"
+ImageExprClass operator-(
+     const ImageExprClass &lhsExpr,
+     const ImageExprClass &rhsExpr
+     )
+{
+  ImageExprClass resultExpr(lhsExpr);
+
+  resultExpr.appendNodes(rhsExpr);
+  resultExpr.appendNode(EXPR_SUBTRACT, 1.0);
+
+  return resultExpr;
+}
+
+// Record "lhsExpr" with its brightness scaled by "adjFactor"
+ImageExprClass operator*(
+     const ImageExprClass &lhsExpr,
+     const double adjFactor
+     )
+{
+  ImageExprClass resultExpr(lhsExpr);
+
+  resultExpr.appendNode(EXPR_SCALE, adjFactor);
 
+  return resultExpr;
+}